@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "cpuid.h"
+
+#define BENCH_SAMPLES	2001U
+#define BENCH_WAKE_NS	20000ULL	/* waiter settles before each store */
+#define BENCH_SIBLING_NS	50000000ULL	/* worker run per sibling row */
+
+static const char *bench_names[] = {
+        "sse3",
+        "ssse3",
+        "sse4.1",
+        "sse4.2",
+        "avx",
+        "avx2",
+        "avx512f",
+        "aes",
+        "pclmulqdq",
+        "sha",
+
+        NULL,	/* terminator */
+};
+
+static volatile int bench_sink;
+static uint64_t bench_overhead;
+
+/*
+ * serialized TSC reads: cpuid_rdtsc() starts the measured window,
+ * nothing after stop leaks into it
+ */
+static inline uint64_t
+bench_stop(void)
+{
+        unsigned lo, hi, aux;
+
+        __asm__ __volatile__ ("rdtscp\n\t"
+                              "lfence\n\t"
+                              : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+        return ((uint64_t) hi << 32) | lo;
+}
+
+static int
+bench_cmp(const void *a,
+          const void *b)
+{
+        uint64_t x = *(const uint64_t *) a;
+        uint64_t y = *(const uint64_t *) b;
+
+        return x < y ? -1 : x > y;
+}
+
+struct bench_result {
+        uint64_t median;
+        uint64_t p99;
+};
+
+static struct bench_result
+bench_stats(uint64_t *samples,
+            unsigned nb)
+{
+        struct bench_result res;
+
+        qsort(samples, nb, sizeof(samples[0]), bench_cmp);
+        res.median = samples[nb / 2];
+        res.p99 = samples[(nb * 99) / 100];
+        res.median = res.median > bench_overhead ? res.median - bench_overhead : 0;
+        res.p99 = res.p99 > bench_overhead ? res.p99 - bench_overhead : 0;
+        return res;
+}
+
+static void
+bench_report(const char *title,
+             struct bench_result res)
+{
+        fprintf(stdout, "%-28s %8llu %8llu\n", title,
+                (unsigned long long) res.median,
+                (unsigned long long) res.p99);
+}
+
+/*
+ * previous lookup: strcmp against every table entry
+ */
+static int
+bench_linear_id(const char *name)
+{
+        const char *p;
+
+        for (int id = 0; (p = cpuid_feature_name(id)) != NULL; id++) {
+                if (!strcmp(name, p))
+                        return id;
+        }
+        return -1;
+}
+
+#define BENCH_RUN(_samples, _stmt)                                      \
+        do {                                                            \
+                for (unsigned _n = 0; _n < BENCH_SAMPLES; _n++) {       \
+                        uint64_t _t = cpuid_rdtsc();                    \
+                        _stmt;                                          \
+                        (_samples)[_n] = bench_stop() - _t;             \
+                }                                                       \
+        } while (0)
+
+static void
+bench_leaves(uint64_t *samples)
+{
+        unsigned leaf, sub_leaf, reg[4];
+
+        for (unsigned i = 0; !cpuid_leaf_entry(i, &leaf, &sub_leaf, reg); i++) {
+                char title[64];
+
+                BENCH_RUN(samples, cpuid_leaf_exec(leaf, sub_leaf, reg));
+                snprintf(title, sizeof(title), "cpuid 0x%08x.%u", leaf, sub_leaf);
+                bench_report(title, bench_stats(samples, BENCH_SAMPLES));
+        }
+}
+
+static void
+bench_lookups(uint64_t *samples)
+{
+        struct cpuid_features have, want;
+        const char *name = bench_names[6];
+        int id = cpuid_feature_id(name);
+
+        BENCH_RUN(samples, bench_sink = cpuid_feature_test(bench_linear_id(name)));
+        bench_report("full table lookup", bench_stats(samples, BENCH_SAMPLES));
+
+        BENCH_RUN(samples, bench_sink = cpuid_feature_test(cpuid_feature_id(name)));
+        bench_report("name index lookup", bench_stats(samples, BENCH_SAMPLES));
+
+        BENCH_RUN(samples, bench_sink = cpuid_feature_test(id));
+        bench_report("cached handle", bench_stats(samples, BENCH_SAMPLES));
+
+        BENCH_RUN(samples, bench_sink = (int) cpuid_flags_read(bench_names));
+        bench_report("cpuid_flags_read (10 names)", bench_stats(samples, BENCH_SAMPLES));
+
+        cpuid_features_read(&have);
+        cpuid_features_from_names(&want, bench_names);
+        BENCH_RUN(samples, bench_sink = cpuid_features_has_all(&have, &want));
+        bench_report("bitset has_all", bench_stats(samples, BENCH_SAMPLES));
+
+        BENCH_RUN(samples, bench_sink = (int) cpuid_isa_level(&want));
+        bench_report("isa level", bench_stats(samples, BENCH_SAMPLES));
+}
+
+static void
+bench_perf(uint64_t *samples)
+{
+        struct cpuid_perf perf;
+        struct cpuid_perf_region region;
+        unsigned mask = (1u << CPUID_PMU_EV_CYCLES) |
+                        (1u << CPUID_PMU_EV_INSTRUCTIONS);
+
+        if (cpuid_perf_open(&perf, mask)) {
+                fprintf(stdout, "%-28s (no PMU)\n", "perf region");
+                return;
+        }
+
+        memset(&region, 0, sizeof(region));
+        BENCH_RUN(samples, (cpuid_perf_begin(&perf, &region),
+                            cpuid_perf_end(&perf, &region)));
+        bench_report(!perf.rdpmc ? "perf region (read)" :
+                     perf.rdpmc < perf.nb ? "perf region (rdpmc+read)" :
+                     "perf region (rdpmc)",
+                     bench_stats(samples, BENCH_SAMPLES));
+        cpuid_perf_close(&perf);
+}
+
+/*
+ * two CPUs of the affinity mask: 0 for SMT siblings,
+ * 1 for distinct cores, -1 with a single CPU
+ */
+static int
+bench_cpu_pair(unsigned cpu[2])
+{
+        cpu_set_t set;
+        unsigned nb = 0;
+
+        if (sched_getaffinity(0, sizeof(set), &set))
+                return -1;
+        for (unsigned c = 0; c < CPU_SETSIZE; c++) {
+                char path[96];
+                FILE *fp;
+                unsigned a, b;
+
+                if (!CPU_ISSET(c, &set))
+                        continue;
+                if (nb < 2)
+                        cpu[nb++] = c;
+                snprintf(path, sizeof(path),
+                         "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list",
+                         c);
+                if (!(fp = fopen(path, "r")))
+                        continue;
+                if (fscanf(fp, "%u%*[,-]%u", &a, &b) == 2 && a != b &&
+                    CPU_ISSET(a, &set) && CPU_ISSET(b, &set)) {
+                        fclose(fp);
+                        cpu[0] = a;
+                        cpu[1] = b;
+                        return 0;
+                }
+                fclose(fp);
+        }
+        return nb == 2 ? 1 : -1;
+}
+
+static void
+bench_pin(unsigned cpu)
+{
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+struct bench_wait {
+        volatile uint64_t flag __attribute__((aligned(64)));
+        volatile uint64_t ready __attribute__((aligned(64)));
+        uint64_t t0;
+        uint64_t *samples;
+        unsigned cpu;
+};
+
+static void *
+bench_waiter(void *arg)
+{
+        struct bench_wait *bw = arg;
+
+        bench_pin(bw->cpu);
+        if (!bw->samples) {
+                cpuid_wait_until(&bw->flag, 0, 0);
+                return NULL;
+        }
+        for (uint64_t n = 0; n < BENCH_SAMPLES; n++) {
+                __atomic_store_n(&bw->ready, n + 1, __ATOMIC_RELEASE);
+                cpuid_wait_until(&bw->flag, n, 0);
+                bw->samples[n] = bench_stop() - bw->t0;
+        }
+        return NULL;
+}
+
+/*
+ * TSC from the store to the waiter running again
+ */
+static int
+bench_wake(uint64_t *samples,
+           const unsigned cpu[2])
+{
+        struct bench_wait bw;
+        pthread_t th;
+
+        memset(&bw, 0, sizeof(bw));
+        bw.samples = samples;
+        bw.cpu = cpu[0];
+        if (pthread_create(&th, NULL, bench_waiter, &bw))
+                return -1;
+        bench_pin(cpu[1]);
+        for (uint64_t n = 0; n < BENCH_SAMPLES; n++) {
+                while (__atomic_load_n(&bw.ready, __ATOMIC_ACQUIRE) != n + 1)
+                        __builtin_ia32_pause();
+                cpuid_wait_delay(BENCH_WAKE_NS);
+                bw.t0 = cpuid_rdtsc();
+                __atomic_store_n(&bw.flag, n + 1, __ATOMIC_RELEASE);
+        }
+        pthread_join(th, NULL);
+        return 0;
+}
+
+/*
+ * loops of a multiply chain per microsecond on cpu[1]
+ * while cpu[0] waits, or idles without a waiter
+ */
+static uint64_t
+bench_sibling(const unsigned cpu[2],
+              int waiter)
+{
+        const struct cpuid_wait *w = cpuid_wait_read();
+        struct bench_wait bw;
+        pthread_t th;
+        uint64_t x = 1, loops = 0, t, end;
+
+        memset(&bw, 0, sizeof(bw));
+        bw.cpu = cpu[0];
+        if (waiter && pthread_create(&th, NULL, bench_waiter, &bw))
+                return 0;
+        bench_pin(cpu[1]);
+        t = cpuid_rdtsc();
+        end = t + BENCH_SIBLING_NS * w->tsc.hz / 1000000000ULL;
+        while (cpuid_rdtsc() < end) {
+                for (unsigned i = 0; i < 1024; i++)
+                        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                loops += 1024;
+        }
+        bench_sink = (int) x;
+        if (waiter) {
+                __atomic_store_n(&bw.flag, 1, __ATOMIC_RELEASE);
+                pthread_join(th, NULL);
+        }
+        return loops / (BENCH_SIBLING_NS / 1000);
+}
+
+static void
+bench_wait(uint64_t *samples)
+{
+        const struct cpuid_wait *w = cpuid_wait_read();
+        enum cpuid_wait_e def = w->method;
+        cpu_set_t saved;
+        unsigned cpu[2];
+        int pair;
+
+        fprintf(stdout, "%-28s %s, pause %llu ticks, backoff %u\n", "wait",
+                cpuid_wait_name(def), (unsigned long long) w->pause_ticks,
+                w->backoff_max);
+        if (!w->tsc.hz) {
+                fprintf(stdout, "%-28s (no TSC rate)\n", "wait wake");
+                return;
+        }
+        pair = bench_cpu_pair(cpu);
+        if (pair < 0) {
+                fprintf(stdout, "%-28s (needs 2 cpus)\n", "wait wake");
+                return;
+        }
+        sched_getaffinity(0, sizeof(saved), &saved);
+
+        for (unsigned m = 0; m < CPUID_WAIT_NB; m++) {
+                char title[64];
+
+                snprintf(title, sizeof(title), "wait wake %s",
+                         cpuid_wait_name(m));
+                if (cpuid_wait_select(m) || bench_wake(samples, cpu)) {
+                        fprintf(stdout, "%-28s (unavailable)\n", title);
+                        continue;
+                }
+                bench_report(title, bench_stats(samples, BENCH_SAMPLES));
+        }
+
+        if (pair) {
+                fprintf(stdout, "%-28s (no SMT sibling)\n", "wait sibling");
+        } else {
+                fprintf(stdout, "%-28s %8llu loops/us\n", "wait sibling idle",
+                        (unsigned long long) bench_sibling(cpu, 0));
+                for (unsigned m = 0; m < CPUID_WAIT_NB; m++) {
+                        char title[64];
+
+                        snprintf(title, sizeof(title), "wait sibling %s",
+                                 cpuid_wait_name(m));
+                        if (cpuid_wait_select(m)) {
+                                fprintf(stdout, "%-28s (unavailable)\n", title);
+                                continue;
+                        }
+                        fprintf(stdout, "%-28s %8llu loops/us\n", title,
+                                (unsigned long long) bench_sibling(cpu, 1));
+                }
+        }
+
+        cpuid_wait_select(def);
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+
+int
+main(void)
+{
+        uint64_t *samples = calloc(BENCH_SAMPLES, sizeof(*samples));
+
+        if (!samples)
+                return 1;
+        cpuid_init();
+
+        /* cost of the timing itself, taken off every result */
+        BENCH_RUN(samples, (void) 0);
+        qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), bench_cmp);
+        bench_overhead = samples[BENCH_SAMPLES / 2];
+
+        fprintf(stdout, "%-28s %8s %8s   (cycles, overhead %llu)\n",
+                "", "median", "p99", (unsigned long long) bench_overhead);
+        bench_leaves(samples);
+        bench_lookups(samples);
+        bench_perf(samples);
+        bench_wait(samples);
+
+        free(samples);
+        return 0;
+}
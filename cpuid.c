@@ -28,7 +28,15 @@
  */
 
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cpuid.h"
 
@@ -47,6 +55,7 @@ struct cpuid_attr {
         enum cpuid_reg_e reg;
         unsigned leaf;
         unsigned sub_leaf;
+        uint64_t xcr0;		/* state the OS must enable, 0: none */
 };
 
 struct cpuid_s {
@@ -55,733 +64,298 @@ struct cpuid_s {
         unsigned reg[CPUID_REG_NB];
 };
 
-#ifndef ARRAYOF
-# define ARRAYOF(_a)	(sizeof(_a)/sizeof(_a[0]))
-#endif
-
 #define CPUID_SUB_LEAF_UNSPEC   0
 #define CPUID_BASIC             0x0U
+#define CPUID_HYPERVISOR        0x40000000U
 #define CPUID_EXT               0x80000000U
 #define CPUID_INVALID		(unsigned) (-1)
 
 
 /*
- * cpuids 
+ * indexed by feature id, expanded from CPUID_FEATURE_LIST()
  */
 static const struct cpuid_attr cpuid_attr[] = {
-        {
-                .name     = "fpu",
-                .bit      = 0,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "vme",
-                .bit      = 1,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "de",
-                .bit      = 2,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pse",
-                .bit      = 3,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "tsc",
-                .bit      = 4,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "msr",
-                .bit      = 5,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pae",
-                .bit      = 6,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "mce",
-                .bit      = 7,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "cx8",
-                .bit      = 8,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "apic",
-                .bit      = 9,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sep",
-                .bit      = 11,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "mtrr",
-                .bit      = 12,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pge",
-                .bit      = 13,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "mca",
-                .bit      = 14,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "cmov",
-                .bit      = 15,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pat",
-                .bit      = 16,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pse-36",
-                .bit      = 17,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "psn",
-                .bit      = 18,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "clfsh",
-                .bit      = 19,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ds",
-                .bit      = 21,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "acpi",
-                .bit      = 22,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "mmx",
-                .bit      = 23,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "fxsr",
-                .bit      = 24,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sse",
-                .bit      = 25,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sse2",
-                .bit      = 26,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ss",
-                .bit      = 27,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "htt",
-                .bit      = 28,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "tm",
-                .bit      = 29,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ia64",
-                .bit      = 30,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pbe",
-                .bit      = 31,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
+#define CPUID_ATTR(_id, _name, _leaf, _sub_leaf, _reg, _bit, _xcr0,     \
+                   _macro)                                              \
+        [CPUID_FEATURE_##_id] = {                                       \
+                .name     = _name,                                      \
+                .bit      = _bit,                                       \
+                .reg      = CPUID_REG_##_reg,                           \
+                .leaf     = _leaf,                                      \
+                .sub_leaf = _sub_leaf,                                  \
+                .xcr0     = _xcr0,                                      \
+        },
+        CPUID_FEATURE_LIST(CPUID_ATTR)
+#undef CPUID_ATTR
 
-        {
-                .name     = "sse3",
-                .bit      = 0,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pclmulqdq",
-                .bit      = 1,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "dtes64",
-                .bit      = 2,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "monitor",
-                .bit      = 3,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ds-cpl",
-                .bit      = 4,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "vmx",
-                .bit      = 5,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "smx",
-                .bit      = 6,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "est",
-                .bit      = 7,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "tm2",
-                .bit      = 8,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ssse3",
-                .bit      = 9,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "cnxt-id",
-                .bit      = 10,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sdbg",
-                .bit      = 11,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "fma",
-                .bit      = 12,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "cx16",
-                .bit      = 13,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "xtpr",
-                .bit      = 14,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pdcm",
-                .bit      = 15,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pcid",
-                .bit      = 17,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "dca",
-                .bit      = 18,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sse4.1",
-                .bit      = 19,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sse4.2",
-                .bit      = 20,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "x2apic",
-                .bit      = 21,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "movbe",
-                .bit      = 22,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "popcnt",
-                .bit      = 23,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "tsc-deadline",
-                .bit      = 24,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "aes",
-                .bit      = 25,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "xsave",
-                .bit      = 26,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "osxsave",
-                .bit      = 27,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx",
-                .bit      = 28,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "f16c",
-                .bit      = 29,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "rdrnd",
-                .bit      = 30,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "hypervisor",
-                .bit      = 31,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x01,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
+        [CPUID_FEATURE_NB] = {/* terminator */
+                .name     = NULL,
         },
+};
 
-        {
-                .name     = "fsgsbase",
-                .bit      = 0,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sgx",
-                .bit      = 2,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "bmi1",
-                .bit      = 3,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "hle",
-                .bit      = 4,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx2",
-                .bit      = 5,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "smep",
-                .bit      = 7,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "bmi2",
-                .bit      = 8,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "erms",
-                .bit      = 9,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "invpcid",
-                .bit      = 10,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "rtm",
-                .bit      = 11,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pqm",
-                .bit      = 12,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "mpx",
-                .bit      = 14,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pq",
-                .bit      = 15,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512f",
-                .bit      = 16,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512dq",
-                .bit      = 17,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "rdseed",
-                .bit      = 18,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "adx",
-                .bit      = 19,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "smap",
-                .bit      = 20,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512ifma",
-                .bit      = 21,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pcommit",
-                .bit      = 22,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "clfushopt",
-                .bit      = 23,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "clwb",
-                .bit      = 24,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "intel_pt",
-                .bit      = 25,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512pf",
-                .bit      = 26,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512er",
-                .bit      = 27,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512cd",
-                .bit      = 28,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sha",
-                .bit      = 29,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512bw",
-                .bit      = 30,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512vl",
-                .bit      = 31,
-                .reg      = CPUID_REG_EBX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
+/*
+ * cpuid_attr[] ids sorted by name, keep in strcmp() order,
+ * cpuid_table_check() tells
+ */
+static const unsigned char cpuid_name_index[] = {
+        CPUID_FEATURE_3DNOW,
+        CPUID_FEATURE_3DNOWEXT,
+        CPUID_FEATURE_ACPI,
+        CPUID_FEATURE_ADX,
+        CPUID_FEATURE_AES,
+        CPUID_FEATURE_AMX_BF16,
+        CPUID_FEATURE_AMX_COMPLEX,
+        CPUID_FEATURE_AMX_FP16,
+        CPUID_FEATURE_AMX_INT8,
+        CPUID_FEATURE_AMX_TILE,
+        CPUID_FEATURE_APIC,
+        CPUID_FEATURE_AVX,
+        CPUID_FEATURE_AVX10,
+        CPUID_FEATURE_AVX2,
+        CPUID_FEATURE_AVX512_4FMAPS,
+        CPUID_FEATURE_AVX512_4VNNIW,
+        CPUID_FEATURE_AVX512_BF16,
+        CPUID_FEATURE_AVX512_BITALG,
+        CPUID_FEATURE_AVX512_FP16,
+        CPUID_FEATURE_AVX512_VBMI2,
+        CPUID_FEATURE_AVX512_VNNI,
+        CPUID_FEATURE_AVX512_VP2INTERSECT,
+        CPUID_FEATURE_AVX512BW,
+        CPUID_FEATURE_AVX512CD,
+        CPUID_FEATURE_AVX512DQ,
+        CPUID_FEATURE_AVX512ER,
+        CPUID_FEATURE_AVX512F,
+        CPUID_FEATURE_AVX512IFMA,
+        CPUID_FEATURE_AVX512PF,
+        CPUID_FEATURE_AVX512VBMI,
+        CPUID_FEATURE_AVX512VL,
+        CPUID_FEATURE_AVX512VPOPCNTDQ,
+        CPUID_FEATURE_AVX_IFMA,
+        CPUID_FEATURE_AVX_NE_CONVERT,
+        CPUID_FEATURE_AVX_VNNI,
+        CPUID_FEATURE_AVX_VNNI_INT16,
+        CPUID_FEATURE_AVX_VNNI_INT8,
+        CPUID_FEATURE_BMI1,
+        CPUID_FEATURE_BMI2,
+        CPUID_FEATURE_CLDEMOTE,
+        CPUID_FEATURE_CLFLUSHOPT,
+        CPUID_FEATURE_CLFSH,
+        CPUID_FEATURE_CLWB,
+        CPUID_FEATURE_CMOV,
+        CPUID_FEATURE_CMP_LEGACY,
+        CPUID_FEATURE_CMPCCXADD,
+        CPUID_FEATURE_CNXT_ID,
+        CPUID_FEATURE_CR8_LEGACY,
+        CPUID_FEATURE_CX16,
+        CPUID_FEATURE_CX8,
+        CPUID_FEATURE_DBX,
+        CPUID_FEATURE_DCA,
+        CPUID_FEATURE_DE,
+        CPUID_FEATURE_DS,
+        CPUID_FEATURE_DS_CPL,
+        CPUID_FEATURE_DTES64,
+        CPUID_FEATURE_ENQCMD,
+        CPUID_FEATURE_ERMS,
+        CPUID_FEATURE_EST,
+        CPUID_FEATURE_EXTAPIC,
+        CPUID_FEATURE_F16C,
+        CPUID_FEATURE_FMA,
+        CPUID_FEATURE_FMA4,
+        CPUID_FEATURE_FPU,
+        CPUID_FEATURE_FSGSBASE,
+        CPUID_FEATURE_FSRC,
+        CPUID_FEATURE_FSRM,
+        CPUID_FEATURE_FSRS,
+        CPUID_FEATURE_FXSR,
+        CPUID_FEATURE_FXSR_OPT,
+        CPUID_FEATURE_FZRM,
+        CPUID_FEATURE_GFNI,
+        CPUID_FEATURE_HLE,
+        CPUID_FEATURE_HTT,
+        CPUID_FEATURE_HYBRID,
+        CPUID_FEATURE_HYPERVISOR,
+        CPUID_FEATURE_IA64,
+        CPUID_FEATURE_IBS,
+        CPUID_FEATURE_INTEL_PT,
+        CPUID_FEATURE_INVPCID,
+        CPUID_FEATURE_INVTSC,
+        CPUID_FEATURE_LA57,
+        CPUID_FEATURE_LAHF_LM,
+        CPUID_FEATURE_LM,
+        CPUID_FEATURE_LWP,
+        CPUID_FEATURE_LZCNT,
+        CPUID_FEATURE_MCA,
+        CPUID_FEATURE_MCE,
+        CPUID_FEATURE_MISALIGNSSE,
+        CPUID_FEATURE_MMX,
+        CPUID_FEATURE_MMXEXT,
+        CPUID_FEATURE_MONITOR,
+        CPUID_FEATURE_MOVBE,
+        CPUID_FEATURE_MOVDIR64B,
+        CPUID_FEATURE_MOVDIRI,
+        CPUID_FEATURE_MPX,
+        CPUID_FEATURE_MSR,
+        CPUID_FEATURE_MTRR,
+        CPUID_FEATURE_MWAITX,
+        CPUID_FEATURE_NODEID_MSR,
+        CPUID_FEATURE_NX,
+        CPUID_FEATURE_OSPKE,
+        CPUID_FEATURE_OSVW,
+        CPUID_FEATURE_OSXSAVE,
+        CPUID_FEATURE_PAE,
+        CPUID_FEATURE_PAT,
+        CPUID_FEATURE_PBE,
+        CPUID_FEATURE_PCID,
+        CPUID_FEATURE_PCLMULQDQ,
+        CPUID_FEATURE_PCOMMIT,
+        CPUID_FEATURE_PDCM,
+        CPUID_FEATURE_PDPE1GB,
+        CPUID_FEATURE_PERFCTR_CORE,
+        CPUID_FEATURE_PERFCTR_LLC,
+        CPUID_FEATURE_PERFCTR_NB,
+        CPUID_FEATURE_PERFTSC,
+        CPUID_FEATURE_PGE,
+        CPUID_FEATURE_PKU,
+        CPUID_FEATURE_POPCNT,
+        CPUID_FEATURE_PQ,
+        CPUID_FEATURE_PQM,
+        CPUID_FEATURE_PREFETCHW,
+        CPUID_FEATURE_PREFETCHWT1,
+        CPUID_FEATURE_PSE,
+        CPUID_FEATURE_PSE_36,
+        CPUID_FEATURE_PSN,
+        CPUID_FEATURE_RDPID,
+        CPUID_FEATURE_RDRND,
+        CPUID_FEATURE_RDSEED,
+        CPUID_FEATURE_RDTSCP,
+        CPUID_FEATURE_RTM,
+        CPUID_FEATURE_SDBG,
+        CPUID_FEATURE_SEP,
+        CPUID_FEATURE_SERIALIZE,
+        CPUID_FEATURE_SGX,
+        CPUID_FEATURE_SGX_LC,
+        CPUID_FEATURE_SHA,
+        CPUID_FEATURE_SKINIT,
+        CPUID_FEATURE_SMAP,
+        CPUID_FEATURE_SMEP,
+        CPUID_FEATURE_SMX,
+        CPUID_FEATURE_SS,
+        CPUID_FEATURE_SSE,
+        CPUID_FEATURE_SSE2,
+        CPUID_FEATURE_SSE3,
+        CPUID_FEATURE_SSE4_1,
+        CPUID_FEATURE_SSE4_2,
+        CPUID_FEATURE_SSE4A,
+        CPUID_FEATURE_SSSE3,
+        CPUID_FEATURE_SVM,
+        CPUID_FEATURE_SYSCALL,
+        CPUID_FEATURE_TBM,
+        CPUID_FEATURE_TCE,
+        CPUID_FEATURE_TM,
+        CPUID_FEATURE_TM2,
+        CPUID_FEATURE_TOPOEXT,
+        CPUID_FEATURE_TSC,
+        CPUID_FEATURE_TSC_DEADLINE,
+        CPUID_FEATURE_TSC_ADJUST,
+        CPUID_FEATURE_UMIP,
+        CPUID_FEATURE_VAES,
+        CPUID_FEATURE_VME,
+        CPUID_FEATURE_VMX,
+        CPUID_FEATURE_VPCLMULQDQ,
+        CPUID_FEATURE_WAITPKG,
+        CPUID_FEATURE_WDT,
+        CPUID_FEATURE_X2APIC,
+        CPUID_FEATURE_XFD,
+        CPUID_FEATURE_XGETBV1,
+        CPUID_FEATURE_XOP,
+        CPUID_FEATURE_XSAVE,
+        CPUID_FEATURE_XSAVEC,
+        CPUID_FEATURE_XSAVEOPT,
+        CPUID_FEATURE_XSAVES,
+        CPUID_FEATURE_XTPR,
+};
 
+_Static_assert(ARRAYOF(cpuid_name_index) == CPUID_FEATURE_NB,
+               "cpuid_name_index[] out of sync with CPUID_FEATURE_LIST()");
+_Static_assert(CPUID_FEATURE_NB <= 256,
+               "cpuid_name_index[] entries too small for cpuid_attr[]");
+_Static_assert(CPUID_FEATURE_NB <= CPUID_FEATURE_MAX,
+               "struct cpuid_features too small for cpuid_attr[]");
 
-        {
-                .name     = "prefetchwt1",
-                .bit      = 0,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512vbmi",
-                .bit      = 1,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "umip",
-                .bit      = 2,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "pku",
-                .bit      = 3,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "ospke",
-                .bit      = 4,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512vpopvntdq",
-                .bit      = 14,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "rdpid",
-                .bit      = 22,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "sgx_lc",
-                .bit      = 30,
-                .reg      = CPUID_REG_ECX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
+/*
+ * leaves with sub-leaves, and how to walk them
+ */
+enum cpuid_sub_e {
+        CPUID_SUB_RANGE = 0,	/* 0 .. nb-1, skip invalid */
+        CPUID_SUB_MAX_EAX,	/* 0 .. EAX of sub-leaf 0 */
+        CPUID_SUB_CACHE,	/* until cache type EAX[4:0] is null */
+        CPUID_SUB_LEVEL,	/* until level type ECX[15:8] is null */
+};
 
+struct cpuid_sub_attr {
+        unsigned leaf;
+        enum cpuid_sub_e type;
+        unsigned nb;
+};
 
-        {
-                .name     = "avx512_4vnniw",
-                .bit      = 2,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
-        {
-                .name     = "avx512_4fmaps",
-                .bit      = 3,
-                .reg      = CPUID_REG_EDX,
-                .leaf     = CPUID_BASIC | 0x07,
-                .sub_leaf = CPUID_SUB_LEAF_UNSPEC,
-        },
+static const struct cpuid_sub_attr cpuid_sub_attr[] = {
+        { CPUID_BASIC | 0x04, CPUID_SUB_CACHE,   16, },
+        { CPUID_BASIC | 0x07, CPUID_SUB_MAX_EAX,  8, },
+        { CPUID_BASIC | 0x0b, CPUID_SUB_LEVEL,    8, },
+        { CPUID_BASIC | 0x0d, CPUID_SUB_RANGE,   64, },
+        { CPUID_BASIC | 0x0f, CPUID_SUB_RANGE,    4, },
+        { CPUID_BASIC | 0x10, CPUID_SUB_RANGE,    4, },
+        { CPUID_BASIC | 0x12, CPUID_SUB_RANGE,   16, },
+        { CPUID_BASIC | 0x14, CPUID_SUB_MAX_EAX,  8, },
+        { CPUID_BASIC | 0x17, CPUID_SUB_MAX_EAX,  8, },
+        { CPUID_BASIC | 0x18, CPUID_SUB_MAX_EAX, 32, },
+        { CPUID_BASIC | 0x1d, CPUID_SUB_MAX_EAX,  8, },
+        { CPUID_BASIC | 0x1f, CPUID_SUB_LEVEL,    8, },
+        { CPUID_BASIC | 0x20, CPUID_SUB_MAX_EAX,  8, },
+        { CPUID_BASIC | 0x23, CPUID_SUB_RANGE,    8, },
+        { CPUID_EXT   | 0x1d, CPUID_SUB_CACHE,   16, },
+        { CPUID_EXT   | 0x20, CPUID_SUB_RANGE,    8, },
+        { CPUID_EXT   | 0x26, CPUID_SUB_LEVEL,    8, },
+};
 
+/* leaves per range, guards against bogus max leaf */
+#define CPUID_RANGE_MAX         0x40U
+#define CPUID_SNAPSHOT_MAX      512
 
-        {/* terminator */
-                .name     = NULL,
-        },
+/*
+ * every valid leaf/sub-leaf, sorted by leaf then sub_leaf.
+ * filled once, read-only afterwards.
+ */
+#define CPUID_SNAPSHOT_MAGIC    0x53444950U	/* "PIDS" */
+#define CPUID_SNAPSHOT_VERSION  1
+#define CPUID_SNAPSHOT_ENV      "CPUID_SNAPSHOT"
+#define CPUID_DUMP_ENV          "CPUID_DUMP"
+#define CPUID_SHARE_ENV         "CPUID_SNAPSHOT_SHARE"
+#define CPUID_SNAPSHOT_SHM      "/dev/shm/cpuid-%u.snapshot"	/* by uid */
+
+/*
+ * also the file format: fixed layout, mapped as is.
+ */
+struct cpuid_snapshot {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;				/* sizeof(struct cpuid_snapshot) */
+        uint32_t signature;			/* leaf 1 EAX */
+        uint32_t table;				/* hash of cpuid_attr[] */
+        uint32_t nb;
+        struct cpuid_s ent[CPUID_SNAPSHOT_MAX];
+        uint64_t xcr0;				/* 0 without OSXSAVE */
+        struct cpuid_features raw;		/* decoded cpuid_attr[] */
+        struct cpuid_features usable;		/* raw with state enabled */
 };
 
+static struct cpuid_snapshot cpuid_snapshot;
+static const struct cpuid_snapshot *cpuid_snap = &cpuid_snapshot;
+static const char *cpuid_snapshot_path;
+static char cpuid_snapshot_shm[64];
+static int cpuid_snapshot_mapped;	/* registers came from a file */
+static pthread_once_t cpuid_snapshot_once = PTHREAD_ONCE_INIT;
+
 static inline int
 cpuid_exec(struct cpuid_s *cpuid,
            const unsigned leaf,
@@ -813,59 +387,782 @@ cpuid_exec(struct cpuid_s *cpuid,
         return ret;
 }
 
+static int
+cpuid_live_exec(void *arg,
+                unsigned leaf,
+                unsigned sub_leaf,
+                unsigned reg[4])
+{
+        struct cpuid_s cpuid;
+        int ret;
+
+        (void) arg;
+        ret = cpuid_exec(&cpuid, leaf, sub_leaf);
+        memcpy(reg, cpuid.reg, sizeof(cpuid.reg));
+        return ret;
+}
+
+static uint64_t
+cpuid_live_xgetbv(void *arg)
+{
+        unsigned lo, hi;
+
+        (void) arg;
+        __asm__ __volatile__ ("xgetbv\n\t"
+                              : "=a" (lo), "=d" (hi)
+                              : "c" (0));
+        return ((uint64_t) hi << 32) | lo;
+}
+
+const struct cpuid_backend cpuid_backend_live = {
+        .name   = "live",
+        .exec   = cpuid_live_exec,
+        .xgetbv = cpuid_live_xgetbv,
+};
+
+static const struct cpuid_backend *cpuid_be = &cpuid_backend_live;
+static const struct cpuid_backend *cpuid_be_req;
+static struct cpuid_backend cpuid_be_dump;
+
+/*
+ * cpuid_exec() through the register source in use
+ */
+static int
+cpuid_be_exec(struct cpuid_s *cpuid,
+              unsigned leaf,
+              unsigned sub_leaf)
+{
+        if (cpuid_be->exec(cpuid_be->arg, leaf, sub_leaf, cpuid->reg)) {
+                memset(cpuid->reg, 0, sizeof(cpuid->reg));
+                cpuid->leaf = CPUID_INVALID;
+                cpuid->sub_leaf = CPUID_INVALID;
+                return -1;
+        }
+        cpuid->leaf = leaf;
+        cpuid->sub_leaf = sub_leaf;
+        return 0;
+}
+
+static const struct cpuid_sub_attr *
+cpuid_sub_attr_find(unsigned leaf)
+{
+        for (unsigned i = 0; i < ARRAYOF(cpuid_sub_attr); i++) {
+                if (cpuid_sub_attr[i].leaf == leaf)
+                        return &cpuid_sub_attr[i];
+        }
+        return NULL;
+}
+
+/*
+ * record one leaf with its sub-leaves
+ */
+static void
+cpuid_snapshot_leaf(struct cpuid_snapshot *snap,
+                    unsigned leaf)
+{
+        const struct cpuid_sub_attr *attr = cpuid_sub_attr_find(leaf);
+        unsigned nb = 1;
+
+        if (attr)
+                nb = attr->nb;
+
+        for (unsigned sub_leaf = 0; sub_leaf < nb; sub_leaf++) {
+                struct cpuid_s *cpuid;
+
+                if (snap->nb >= ARRAYOF(snap->ent))
+                        return;
+                cpuid = &snap->ent[snap->nb];
+
+                if (cpuid_be_exec(cpuid, leaf, sub_leaf)) {
+                        if (attr && attr->type == CPUID_SUB_RANGE)
+                                continue;
+                        return;
+                }
+
+                if (attr) {
+                        switch (attr->type) {
+                        case CPUID_SUB_MAX_EAX:
+                                if (sub_leaf == 0 &&
+                                    cpuid->reg[CPUID_REG_EAX] + 1 < nb)
+                                        nb = cpuid->reg[CPUID_REG_EAX] + 1;
+                                break;
+                        case CPUID_SUB_CACHE:
+                                if (!(cpuid->reg[CPUID_REG_EAX] & 0x1f))
+                                        return;
+                                break;
+                        case CPUID_SUB_LEVEL:
+                                if (!(cpuid->reg[CPUID_REG_ECX] & 0xff00))
+                                        return;
+                                break;
+                        case CPUID_SUB_RANGE:
+                        default:
+                                break;
+                        }
+                }
+                snap->nb++;
+        }
+}
+
+static void
+cpuid_snapshot_range(struct cpuid_snapshot *snap,
+                     unsigned base)
+{
+        struct cpuid_s cpuid;
+        unsigned max;
+
+        if (cpuid_be_exec(&cpuid, base, 0))
+                return;
+
+        max = cpuid.reg[CPUID_REG_EAX];
+        if (max < base) {
+                /* old KVM reports 0 for 0x40000001 */
+                if (base != CPUID_HYPERVISOR)
+                        return;
+                max = base | 0x01;
+        }
+        if (max - base >= CPUID_RANGE_MAX)
+                max = base + CPUID_RANGE_MAX - 1;
+
+        for (unsigned leaf = base; leaf <= max; leaf++)
+                cpuid_snapshot_leaf(snap, leaf);
+}
+
+/*
+ * binary search, entries are sorted by leaf/sub_leaf
+ */
+static const struct cpuid_s *
+cpuid_snapshot_find(const struct cpuid_snapshot *snap,
+                    unsigned leaf,
+                    unsigned sub_leaf)
+{
+        unsigned lo = 0;
+        unsigned hi = snap->nb;
+
+        while (lo < hi) {
+                unsigned mid = (lo + hi) / 2;
+                const struct cpuid_s *cpuid = &snap->ent[mid];
+
+                if (cpuid->leaf < leaf ||
+                    (cpuid->leaf == leaf && cpuid->sub_leaf < sub_leaf))
+                        lo = mid + 1;
+                else if (cpuid->leaf == leaf && cpuid->sub_leaf == sub_leaf)
+                        return cpuid;
+                else
+                        hi = mid;
+        }
+        return NULL;
+}
+
 /*
  *
  */
 static unsigned
-cpuid_reg_read(struct cpuid_s *cpuid,
+cpuid_reg_read(const struct cpuid_snapshot *snap,
                unsigned leaf,
                unsigned sub_leaf,
                enum cpuid_reg_e reg_id)
 {
-        unsigned ret = 0;
+        const struct cpuid_s *cpuid;
 
-        if (cpuid->leaf == leaf && cpuid->sub_leaf == sub_leaf) {
-                ret = cpuid->reg[reg_id];
-        } else {
-                /* read MAX CPUID_BASIC or CPUID_EXT */
-                if (!cpuid_exec(cpuid, CPUID_EXT & leaf, 0)) {
+        cpuid = cpuid_snapshot_find(snap, leaf, sub_leaf);
+        if (cpuid)
+                return cpuid->reg[reg_id];
+        return 0;
+}
 
-                        if (cpuid->reg[CPUID_REG_EAX] >= leaf) {
-                                if (!cpuid_exec(cpuid, leaf, sub_leaf)) {
-                                        ret = cpuid->reg[reg_id];
-                                }
-                        }
+/*
+ * decode every cpuid_attr[] entry into the feature bits
+ */
+static void
+cpuid_snapshot_decode(struct cpuid_snapshot *snap)
+{
+        cpuid_features_zero(&snap->raw);
+        cpuid_features_zero(&snap->usable);
+
+        for (unsigned i = 0; i < CPUID_FEATURE_NB; i++) {
+                unsigned reg = cpuid_reg_read(snap,
+                                              cpuid_attr[i].leaf,
+                                              cpuid_attr[i].sub_leaf,
+                                              cpuid_attr[i].reg);
+
+                if (!(reg & (1u << cpuid_attr[i].bit)))
+                        continue;
+
+                cpuid_features_set(&snap->raw, (int) i);
+                if ((snap->xcr0 & cpuid_attr[i].xcr0) == cpuid_attr[i].xcr0)
+                        cpuid_features_set(&snap->usable, (int) i);
+        }
+}
+
+/*
+ * XCR0, state components enabled by the OS. 0 unless OSXSAVE.
+ */
+static uint64_t
+cpuid_xgetbv(const struct cpuid_snapshot *snap)
+{
+        if (!(cpuid_reg_read(snap, CPUID_BASIC | 0x01, 0,
+                             CPUID_REG_ECX) & (1u << 27)))
+                return 0;
+        return cpuid_be->xgetbv(cpuid_be->arg);
+}
+
+static int
+cpuid_attr_check(const struct cpuid_attr *attr)
+{
+        unsigned base = attr->leaf & 0xf0000000U;
+
+        if (!attr->name || attr->reg >= CPUID_REG_NB || attr->bit >= 32)
+                return -1;
+        if (base != CPUID_BASIC && base != CPUID_HYPERVISOR &&
+            base != CPUID_EXT)
+                return -1;
+        if (attr->sub_leaf != CPUID_SUB_LEAF_UNSPEC &&
+            !cpuid_sub_attr_find(attr->leaf))
+                return -1;
+
+        /* vector and tile families need their XCR0 state */
+        if (!strncmp(attr->name, "avx512", 6) &&
+            (attr->xcr0 & CPUID_XCR0_AVX512) != CPUID_XCR0_AVX512)
+                return -1;
+        if (!strncmp(attr->name, "avx", 3) &&
+            (attr->xcr0 & CPUID_XCR0_AVX) != CPUID_XCR0_AVX)
+                return -1;
+        if (!strncmp(attr->name, "amx", 3) &&
+            (attr->xcr0 & CPUID_XCR0_AMX) != CPUID_XCR0_AMX)
+                return -1;
+        return 0;
+}
+
+/*
+ * consistency of cpuid_attr[] and cpuid_name_index[]:
+ * valid leaf/register/bit, no bit decoded twice, XCR0 of the
+ * vector families, names unique and sorted.
+ * returns the number of bad entries.
+ */
+int
+cpuid_table_check(void)
+{
+        int bad = 0;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_NB; i++) {
+                const struct cpuid_attr *attr = &cpuid_attr[i];
+
+                if (cpuid_attr_check(attr)) {
+                        bad++;
+                        continue;
+                }
+                for (unsigned j = 0; j < i; j++) {
+                        if (cpuid_attr[j].leaf == attr->leaf &&
+                            cpuid_attr[j].sub_leaf == attr->sub_leaf &&
+                            cpuid_attr[j].reg == attr->reg &&
+                            cpuid_attr[j].bit == attr->bit)
+                                bad++;
+                }
+        }
+
+        for (unsigned i = 1; i < ARRAYOF(cpuid_name_index); i++) {
+                if (strcmp(cpuid_attr[cpuid_name_index[i - 1]].name,
+                           cpuid_attr[cpuid_name_index[i]].name) >= 0)
+                        bad++;
+        }
+        return bad;
+}
+
+/*
+ * FNV-1a of cpuid_attr[], decoded bitsets are only valid with
+ * the same table
+ */
+static uint32_t
+cpuid_table_hash(void)
+{
+        uint32_t hash = 2166136261U;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_NB; i++) {
+                const struct cpuid_attr *attr = &cpuid_attr[i];
+                uint32_t v[] = {
+                        attr->bit, attr->reg, attr->leaf, attr->sub_leaf,
+                        (uint32_t) attr->xcr0, (uint32_t) (attr->xcr0 >> 32),
+                };
+
+                for (const char *p = attr->name; *p; p++)
+                        hash = (hash ^ (uint8_t) *p) * 16777619U;
+                for (unsigned j = 0; j < ARRAYOF(v); j++)
+                        hash = (hash ^ v[j]) * 16777619U;
+        }
+        return hash;
+}
+
+static void
+cpuid_snapshot_hdr(struct cpuid_snapshot *snap)
+{
+        snap->magic = CPUID_SNAPSHOT_MAGIC;
+        snap->version = CPUID_SNAPSHOT_VERSION;
+        snap->size = sizeof(*snap);
+        snap->table = cpuid_table_hash();
+        snap->signature = cpuid_reg_read(snap, CPUID_BASIC | 0x01, 0,
+                                         CPUID_REG_EAX);
+}
+
+/*
+ * map a snapshot file, NULL if it does not belong to this
+ * CPU and OS. costs a single cpuid for the signature.
+ */
+static const struct cpuid_snapshot *
+cpuid_snapshot_map(const char *path,
+                   int own)
+{
+        const struct cpuid_snapshot *snap;
+        struct cpuid_s cpuid;
+        struct stat st;
+        void *p;
+        int fd;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+        if (fstat(fd, &st) || st.st_size != (off_t) sizeof(*snap) ||
+            (own && st.st_uid != geteuid())) {
+                close(fd);
+                return NULL;
+        }
+        p = mmap(NULL, sizeof(*snap), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+                return NULL;
+
+        snap = p;
+        cpuid_exec(&cpuid, CPUID_BASIC | 0x01, 0);
+        if (snap->magic != CPUID_SNAPSHOT_MAGIC ||
+            snap->version != CPUID_SNAPSHOT_VERSION ||
+            snap->size != sizeof(*snap) ||
+            snap->nb > CPUID_SNAPSHOT_MAX ||
+            snap->signature != cpuid.reg[CPUID_REG_EAX] ||
+            snap->xcr0 != cpuid_xgetbv(snap)) {
+                munmap(p, sizeof(*snap));
+                return NULL;
+        }
+        return snap;
+}
+
+static int
+cpuid_snapshot_save(const struct cpuid_snapshot *snap,
+                    const char *path)
+{
+        char tmp[4096];
+        ssize_t len;
+        int fd;
+
+        if ((size_t) snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid())
+            >= sizeof(tmp))
+                return -1;
+
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0)
+                return -1;
+        len = write(fd, snap, sizeof(*snap));
+        if (close(fd) || len != (ssize_t) sizeof(*snap) || rename(tmp, path)) {
+                unlink(tmp);
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * every cpuid traps to the hypervisor: with CPUID_SNAPSHOT_SHARE=1
+ * the processes of a user share one snapshot on tmpfs, unless
+ * CPUID_SNAPSHOT names a file or is set empty. off by default,
+ * nothing is written unasked.
+ */
+static const char *
+cpuid_snapshot_shm_path(void)
+{
+        const char *share = getenv(CPUID_SHARE_ENV);
+        struct cpuid_s cpuid;
+
+        if (!share || strcmp(share, "1"))
+                return NULL;
+        if (cpuid_exec(&cpuid, CPUID_BASIC | 0x01, 0) ||
+            !(cpuid.reg[CPUID_REG_ECX] & (1u << 31)))
+                return NULL;
+
+        snprintf(cpuid_snapshot_shm, sizeof(cpuid_snapshot_shm),
+                 CPUID_SNAPSHOT_SHM, (unsigned) geteuid());
+        return cpuid_snapshot_shm;
+}
+
+static void
+cpuid_snapshot_init(void)
+{
+        const char *path = cpuid_snapshot_path;
+        const char *shm = NULL;
+
+        if (cpuid_be_req) {
+                cpuid_be = cpuid_be_req;
+        } else if (getenv(CPUID_DUMP_ENV) &&
+                   !cpuid_dump_open(&cpuid_be_dump, getenv(CPUID_DUMP_ENV))) {
+                cpuid_be = &cpuid_be_dump;
+        }
+
+        /* a snapshot file only stands for the live CPU */
+        if (!path && cpuid_be == &cpuid_backend_live) {
+                path = getenv(CPUID_SNAPSHOT_ENV);
+                if (!path)
+                        path = shm = cpuid_snapshot_shm_path();
+                else if (!*path)
+                        path = NULL;
+        }
+        if (path && cpuid_be == &cpuid_backend_live) {
+                const struct cpuid_snapshot *snap =
+                        cpuid_snapshot_map(path, shm != NULL);
+
+                if (snap)
+                        cpuid_snapshot_mapped = 1;
+                if (snap && snap->table == cpuid_table_hash()) {
+                        cpuid_snap = snap;
+                        return;
+                }
+                if (snap) {
+                        /* other library version: registers are still good */
+                        cpuid_snapshot = *snap;
+                        munmap((void *) (uintptr_t) snap, sizeof(*snap));
+                        cpuid_snapshot_decode(&cpuid_snapshot);
+                        cpuid_snapshot_hdr(&cpuid_snapshot);
+                        if (shm)
+                                (void) cpuid_snapshot_save(&cpuid_snapshot, shm);
+                        return;
                 }
         }
+
+        cpuid_snapshot.nb = 0;
+        cpuid_snapshot_range(&cpuid_snapshot, CPUID_BASIC);
+        /* only meaningful with the hypervisor bit */
+        if (cpuid_reg_read(&cpuid_snapshot, CPUID_BASIC | 0x01, 0,
+                           CPUID_REG_ECX) & (1u << 31))
+                cpuid_snapshot_range(&cpuid_snapshot, CPUID_HYPERVISOR);
+        cpuid_snapshot_range(&cpuid_snapshot, CPUID_EXT);
+        cpuid_snapshot.xcr0 = cpuid_xgetbv(&cpuid_snapshot);
+        cpuid_snapshot_decode(&cpuid_snapshot);
+        cpuid_snapshot_hdr(&cpuid_snapshot);
+        /* best effort, the next process maps it */
+        if (shm)
+                (void) cpuid_snapshot_save(&cpuid_snapshot, shm);
+}
+
+static inline const struct cpuid_snapshot *
+cpuid_snapshot_get(void)
+{
+        pthread_once(&cpuid_snapshot_once, cpuid_snapshot_init);
+        return cpuid_snap;
+}
+
+/*
+ * use the snapshot file at path instead of probing.
+ * must come before any query, 0 if the file was taken.
+ */
+int
+cpuid_snapshot_load(const char *path)
+{
+        cpuid_snapshot_path = path;
+        cpuid_snapshot_get();
+        return cpuid_snapshot_mapped ? 0 : -1;
+}
+
+/*
+ * take registers from be instead of the cpuid instruction.
+ * must come before any query, 0 if be was taken.
+ */
+int
+cpuid_backend_set(const struct cpuid_backend *be)
+{
+        cpuid_be_req = be;
+        cpuid_snapshot_get();
+        return cpuid_be == be ? 0 : -1;
+}
+
+const struct cpuid_backend *
+cpuid_backend_get(void)
+{
+        cpuid_snapshot_get();
+        return cpuid_be;
+}
+
+/*
+ * i-th recorded leaf, in leaf/sub_leaf order. -1 past the end.
+ */
+int
+cpuid_leaf_entry(unsigned i,
+                 unsigned *leaf,
+                 unsigned *sub_leaf,
+                 unsigned reg[4])
+{
+        const struct cpuid_snapshot *snap = cpuid_snapshot_get();
+
+        if (i >= snap->nb)
+                return -1;
+
+        *leaf = snap->ent[i].leaf;
+        *sub_leaf = snap->ent[i].sub_leaf;
+        memcpy(reg, snap->ent[i].reg, sizeof(snap->ent[i].reg));
+        return 0;
+}
+
+/*
+ * write the snapshot in use to path, replaced atomically
+ */
+int
+cpuid_snapshot_write(const char *path)
+{
+        return cpuid_snapshot_save(cpuid_snapshot_get(), path);
+}
+
+/*
+ * take the snapshot now instead of on first query
+ */
+void
+cpuid_init(void)
+{
+        (void) cpuid_snapshot_get();
+}
+
+/*
+ * raw registers of leaf/sub_leaf from the snapshot
+ */
+int
+cpuid_leaf_read(unsigned leaf,
+                unsigned sub_leaf,
+                unsigned reg[4])
+{
+        const struct cpuid_s *cpuid;
+
+        cpuid = cpuid_snapshot_find(cpuid_snapshot_get(), leaf, sub_leaf);
+        if (!cpuid)
+                return -1;
+
+        memcpy(reg, cpuid->reg, sizeof(cpuid->reg));
+        return 0;
+}
+
+/*
+ * execute cpuid on the calling CPU, bypassing the snapshot.
+ * for per-CPU leaves only, every call may trap under a hypervisor.
+ * a replay backend answers with its recorded CPU.
+ */
+int
+cpuid_leaf_exec(unsigned leaf,
+                unsigned sub_leaf,
+                unsigned reg[4])
+{
+        const struct cpuid_backend *be = cpuid_backend_get();
+
+        return be->exec(be->arg, leaf, sub_leaf, reg);
+}
+
+/*
+ * name to feature id, binary search in cpuid_name_index[]
+ */
+int
+cpuid_feature_id(const char *name)
+{
+        unsigned lo = 0;
+        unsigned hi = ARRAYOF(cpuid_name_index);
+
+        while (lo < hi) {
+                unsigned mid = (lo + hi) / 2;
+                unsigned id = cpuid_name_index[mid];
+                int cmp = strcmp(name, cpuid_attr[id].name);
+
+                if (!cmp)
+                        return (int) id;
+                if (cmp < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+        return -1;
+}
+
+const char *
+cpuid_feature_name(int id)
+{
+        if (id < 0 || id >= CPUID_FEATURE_NB)
+                return NULL;
+        return cpuid_attr[id].name;
+}
+
+/*
+ * id from cpuid_feature_id(), true if the feature is usable
+ */
+int
+cpuid_feature_test(int id)
+{
+        const struct cpuid_snapshot *snap = cpuid_snapshot_get();
+
+        return cpuid_features_isset(&snap->usable, id);
+}
+
+/*
+ * usable features: reported by CPUID and their state enabled in XCR0
+ */
+void
+cpuid_features_read(struct cpuid_features *set)
+{
+        *set = cpuid_snapshot_get()->usable;
+}
+
+/*
+ * raw features: as reported by CPUID
+ */
+void
+cpuid_features_read_raw(struct cpuid_features *set)
+{
+        *set = cpuid_snapshot_get()->raw;
+}
+
+uint64_t
+cpuid_xcr0(void)
+{
+        return cpuid_snapshot_get()->xcr0;
+}
+
+static int
+cpuid_s_cmp(const void *a,
+            const void *b)
+{
+        const struct cpuid_s *x = a;
+        const struct cpuid_s *y = b;
+
+        if (x->leaf != y->leaf)
+                return x->leaf < y->leaf ? -1 : 1;
+        if (x->sub_leaf != y->sub_leaf)
+                return x->sub_leaf < y->sub_leaf ? -1 : 1;
+        return 0;
+}
+
+/*
+ * linear search, for a snapshot still being filled
+ */
+static const struct cpuid_s *
+cpuid_snapshot_lookup(const struct cpuid_snapshot *snap,
+                      unsigned leaf,
+                      unsigned sub_leaf)
+{
+        for (unsigned i = 0; i < snap->nb; i++) {
+                if (snap->ent[i].leaf == leaf &&
+                    snap->ent[i].sub_leaf == sub_leaf)
+                        return &snap->ent[i];
+        }
+        return NULL;
+}
+
+/*
+ * usable features of the calling CPU, executing only the leaves
+ * cpuid_attr[] refers to. hybrid parts differ between core types.
+ */
+int
+cpuid_features_exec(struct cpuid_features *set)
+{
+        const struct cpuid_snapshot *global = cpuid_snapshot_get();
+        struct cpuid_snapshot *snap;
+
+        snap = calloc(1, sizeof(*snap));
+        if (!snap)
+                return -1;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_NB; i++) {
+                unsigned leaf = cpuid_attr[i].leaf;
+                unsigned sub_leaf = cpuid_attr[i].sub_leaf;
+
+                /* leaves beyond max are not reliable, follow the snapshot */
+                if (!cpuid_snapshot_find(global, leaf, sub_leaf) ||
+                    cpuid_snapshot_lookup(snap, leaf, sub_leaf))
+                        continue;
+                if (!cpuid_be_exec(&snap->ent[snap->nb], leaf, sub_leaf))
+                        snap->nb++;
+        }
+        qsort(snap->ent, snap->nb, sizeof(snap->ent[0]), cpuid_s_cmp);
+
+        snap->xcr0 = global->xcr0;
+        cpuid_snapshot_decode(snap);
+        *set = snap->usable;
+        free(snap);
+        return 0;
+}
+
+/*
+ * usable features of this CPU straight from cpuid and xgetbv:
+ * no snapshot, backend, environment, file, allocation or lock.
+ * safe in an ifunc resolver, which runs before libc is set up.
+ */
+void
+cpuid_features_live(struct cpuid_features *set)
+{
+        struct cpuid_s cpuid;
+        unsigned max_basic, max_ext;
+        uint64_t xcr0 = 0;
+
+        cpuid_exec(&cpuid, CPUID_BASIC, 0);
+        max_basic = cpuid.reg[CPUID_REG_EAX];
+        cpuid_exec(&cpuid, CPUID_EXT, 0);
+        max_ext = cpuid.reg[CPUID_REG_EAX];
+        cpuid_exec(&cpuid, CPUID_BASIC | 0x01, 0);
+        if (cpuid.reg[CPUID_REG_ECX] & (1u << 27))
+                xcr0 = cpuid_live_xgetbv(NULL);
+
+        cpuid_features_zero(set);
+        for (unsigned i = 0; i < CPUID_FEATURE_NB; i++) {
+                const struct cpuid_attr *attr = &cpuid_attr[i];
+                unsigned base = attr->leaf & 0xf0000000U;
+
+                if ((base == CPUID_BASIC && attr->leaf > max_basic) ||
+                    (base == CPUID_EXT && attr->leaf > max_ext) ||
+                    base == CPUID_HYPERVISOR)
+                        continue;
+                if (cpuid.leaf != attr->leaf ||
+                    cpuid.sub_leaf != attr->sub_leaf)
+                        cpuid_exec(&cpuid, attr->leaf, attr->sub_leaf);
+
+                if ((cpuid.reg[attr->reg] & (1u << attr->bit)) &&
+                    (xcr0 & attr->xcr0) == attr->xcr0)
+                        cpuid_features_set(set, (int) i);
+        }
+}
+
+/*
+ * set of the named features, -1 if a name is unknown
+ */
+int
+cpuid_features_from_names(struct cpuid_features *set,
+                          const char **names)
+{
+        int ret = 0;
+
+        cpuid_features_zero(set);
+        for (unsigned n = 0; names[n]; n++) {
+                int id = cpuid_feature_id(names[n]);
+
+                if (id < 0)
+                        ret = -1;
+                else
+                        cpuid_features_set(set, id);
+        }
         return ret;
 }
 
 /*
- * max number of names: 32 names
+ * bit n is set when names[n] is usable; only the first 32 names are read,
+ * the rest are ignored. Longer lists go through cpuid_features_from_names()
+ * and cpuid_features_has_all().
  */
 unsigned
 cpuid_flags_read(const char **names)
 {
         unsigned bits = 0;
-        struct cpuid_s cpuid = {
-                .leaf     = CPUID_INVALID,
-                .sub_leaf = CPUID_INVALID,
-        };
 
         for (unsigned n = 0; names[n]; n++) {
-                for (unsigned i = 0; cpuid_attr[i].name; i++) {
-                        unsigned reg;
-                        
-                        if (strcmp(names[n], cpuid_attr[i].name))
-                                continue;
-
-                        reg = cpuid_reg_read(&cpuid,
-                                             cpuid_attr[i].leaf,
-                                             cpuid_attr[i].sub_leaf,
-                                             cpuid_attr[i].reg);
-                        if (reg & (1u << cpuid_attr[i].bit))
-                                bits |= (1u << n);
-                }
+                if (n >= 32)
+                        break;
+                if (cpuid_feature_test(cpuid_feature_id(names[n])))
+                        bits |= (1u << n);
         }
         return bits;
 }
@@ -1,6 +1,705 @@
 #ifndef _CPUID_H_
 #define _CPUID_H_
 
+#include <stdint.h>
+#include <stdio.h>
+#include <sched.h>
+
+/*
+ * XCR0 state components, see cpuid_xcr0()
+ */
+#define CPUID_XCR0_X87          (UINT64_C(1) << 0)
+#define CPUID_XCR0_SSE          (UINT64_C(1) << 1)
+#define CPUID_XCR0_YMM          (UINT64_C(1) << 2)
+#define CPUID_XCR0_OPMASK       (UINT64_C(1) << 5)
+#define CPUID_XCR0_ZMM_HI256    (UINT64_C(1) << 6)
+#define CPUID_XCR0_HI16_ZMM     (UINT64_C(1) << 7)
+#define CPUID_XCR0_TILECFG      (UINT64_C(1) << 17)
+#define CPUID_XCR0_TILEDATA     (UINT64_C(1) << 18)
+
+#define CPUID_XCR0_AVX          (CPUID_XCR0_SSE | CPUID_XCR0_YMM)
+#define CPUID_XCR0_AVX512       (CPUID_XCR0_AVX | CPUID_XCR0_OPMASK |  \
+                                 CPUID_XCR0_ZMM_HI256 | CPUID_XCR0_HI16_ZMM)
+#define CPUID_XCR0_AMX          (CPUID_XCR0_TILECFG | CPUID_XCR0_TILEDATA)
+
+#include "cpuid_feature.h"
+
+/* elements of an array, not of a pointer */
+#ifndef ARRAYOF
+# define ARRAYOF(_a)	(sizeof(_a)/sizeof(_a[0]))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * feature bitset, bit number is the id from cpuid_feature_id()
+ */
+#define CPUID_FEATURE_WORDS	4
+#define CPUID_FEATURE_MAX	(CPUID_FEATURE_WORDS * 64)
+
+struct cpuid_features {
+        uint64_t w[CPUID_FEATURE_WORDS];
+};
+
+static inline void
+cpuid_features_zero(struct cpuid_features *set)
+{
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                set->w[i] = 0;
+}
+
+static inline void
+cpuid_features_set(struct cpuid_features *set,
+                   int id)
+{
+        if (id >= 0 && id < CPUID_FEATURE_MAX)
+                set->w[id / 64] |= UINT64_C(1) << (id % 64);
+}
+
+static inline void
+cpuid_features_clear(struct cpuid_features *set,
+                     int id)
+{
+        if (id >= 0 && id < CPUID_FEATURE_MAX)
+                set->w[id / 64] &= ~(UINT64_C(1) << (id % 64));
+}
+
+static inline int
+cpuid_features_isset(const struct cpuid_features *set,
+                     int id)
+{
+        if (id < 0 || id >= CPUID_FEATURE_MAX)
+                return 0;
+        return (int) ((set->w[id / 64] >> (id % 64)) & 1);
+}
+
+static inline int
+cpuid_features_empty(const struct cpuid_features *set)
+{
+        uint64_t acc = 0;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                acc |= set->w[i];
+        return !acc;
+}
+
+static inline int
+cpuid_features_equal(const struct cpuid_features *a,
+                     const struct cpuid_features *b)
+{
+        uint64_t acc = 0;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                acc |= a->w[i] ^ b->w[i];
+        return !acc;
+}
+
+/* every feature of want is in have */
+static inline int
+cpuid_features_has_all(const struct cpuid_features *have,
+                       const struct cpuid_features *want)
+{
+        uint64_t acc = 0;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                acc |= want->w[i] & ~have->w[i];
+        return !acc;
+}
+
+/* at least one feature of want is in have */
+static inline int
+cpuid_features_has_any(const struct cpuid_features *have,
+                       const struct cpuid_features *want)
+{
+        uint64_t acc = 0;
+
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                acc |= want->w[i] & have->w[i];
+        return acc != 0;
+}
+
+/* a is a subset of b */
+static inline int
+cpuid_features_subset(const struct cpuid_features *a,
+                      const struct cpuid_features *b)
+{
+        return cpuid_features_has_all(b, a);
+}
+
+/* a is a superset of b */
+static inline int
+cpuid_features_superset(const struct cpuid_features *a,
+                        const struct cpuid_features *b)
+{
+        return cpuid_features_has_all(a, b);
+}
+
+static inline void
+cpuid_features_and(struct cpuid_features *dst,
+                   const struct cpuid_features *a,
+                   const struct cpuid_features *b)
+{
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                dst->w[i] = a->w[i] & b->w[i];
+}
+
+static inline void
+cpuid_features_or(struct cpuid_features *dst,
+                  const struct cpuid_features *a,
+                  const struct cpuid_features *b)
+{
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                dst->w[i] = a->w[i] | b->w[i];
+}
+
+/* dst = a & ~b, what a has and b lacks */
+static inline void
+cpuid_features_andnot(struct cpuid_features *dst,
+                      const struct cpuid_features *a,
+                      const struct cpuid_features *b)
+{
+        for (unsigned i = 0; i < CPUID_FEATURE_WORDS; i++)
+                dst->w[i] = a->w[i] & ~b->w[i];
+}
+
+/*
+ * runtime dispatch: one entry per implementation of a hot function,
+ * features is a NULL terminated list of names, NULL for the baseline.
+ */
+typedef void (*cpuid_fn_t)(void);
+
+struct cpuid_impl {
+        const char *name;
+        cpuid_fn_t fn;
+        const char **features;
+        int priority;
+};
+
+#define CPUID_IMPL(_fn, _features, _priority)                           \
+        {                                                               \
+                .name     = #_fn,                                       \
+                .fn       = (cpuid_fn_t) (_fn),                         \
+                .features = (_features),                                \
+                .priority = (_priority),                                \
+        }
+
+#define CPUID_IMPL_NB(_impls)	ARRAYOF(_impls)
+
+/*
+ * fill function pointer _ptr once, NULL when nothing matches
+ */
+#define CPUID_DISPATCH(_ptr, _impls)                                    \
+        do {                                                            \
+                const struct cpuid_impl *_impl =                        \
+                        cpuid_impl_select((_impls),                     \
+                                          CPUID_IMPL_NB(_impls), NULL); \
+                (_ptr) = _impl ? (__typeof__(_ptr)) _impl->fn : NULL;   \
+        } while (0)
+
+/*
+ * GNU ifunc resolver for _fn, declare the function with
+ * __attribute__((ifunc(#_fn "_resolver"))).
+ * resolvers run during relocation, before libc is usable: this one
+ * only executes cpuid/xgetbv, see cpuid_impl_resolve(). so no
+ * CPUID_MASK, no replayed dump, and no AMX impls since the tile
+ * permission needs a syscall: pick those with CPUID_DISPATCH().
+ * libcpuid must be linked into the object itself (libcpuid.a).
+ */
+#define CPUID_IFUNC_RESOLVER(_fn, _impls)                               \
+        static __typeof__(&_fn) _fn##_resolver(void)                    \
+        {                                                               \
+                const struct cpuid_impl *_impl =                        \
+                        cpuid_impl_resolve((_impls),                    \
+                                           CPUID_IMPL_NB(_impls));      \
+                return _impl ? (__typeof__(&_fn)) _impl->fn : NULL;     \
+        }
+
+/*
+ * cache hierarchy from leaf 4 or 0x8000001D
+ */
+enum cpuid_cache_type_e {
+        CPUID_CACHE_NULL = 0,
+        CPUID_CACHE_DATA,
+        CPUID_CACHE_INST,
+        CPUID_CACHE_UNIFIED,
+};
+
+#define CPUID_CACHE_F_SELF_INIT         (1u << 0)
+#define CPUID_CACHE_F_FULLY_ASSOC       (1u << 1)
+#define CPUID_CACHE_F_INCLUSIVE         (1u << 2)
+#define CPUID_CACHE_F_COMPLEX_INDEX     (1u << 3)
+
+#define CPUID_CACHE_MAX	16
+
+struct cpuid_cache {
+        unsigned level;
+        enum cpuid_cache_type_e type;
+        unsigned size;		/* bytes */
+        unsigned line_size;	/* bytes */
+        unsigned ways;
+        unsigned partitions;
+        unsigned sets;
+        unsigned shared;	/* max logical CPUs sharing it, 0: unknown */
+        unsigned flags;
+};
+
+/*
+ * per logical CPU topology, from leaf 0x1F/0xB on each CPU.
+ * core, module, die, package and l3 are the APIC ID bits above
+ * that level: equal values share it, unique system wide.
+ */
+enum cpuid_core_type_e {
+        CPUID_CORE_UNKNOWN = 0,		/* not hybrid */
+        CPUID_CORE_EFFICIENT = 0x20,	/* Atom, E-core */
+        CPUID_CORE_PERFORMANCE = 0x40,	/* Core, P-core */
+};
+
+struct cpuid_cpu {
+        int cpu;		/* OS CPU number */
+        unsigned apic_id;	/* x2APIC ID */
+        unsigned smt;		/* thread within its core */
+        unsigned core;
+        unsigned module;
+        unsigned die;
+        unsigned package;
+        unsigned l3;		/* last level cache */
+        enum cpuid_core_type_e core_type;	/* leaf 0x1A */
+        unsigned native_model;
+        struct cpuid_features features;		/* usable on this CPU */
+};
+
+struct cpuid_topology {
+        unsigned nb;
+        struct cpuid_cpu cpu[];
+};
+
+struct cpuid_core_group {
+        enum cpuid_core_type_e type;
+        unsigned nb;
+        cpu_set_t cpus;
+        struct cpuid_features features;	/* common to all its CPUs */
+};
+
+enum cpuid_plan_e {
+        CPUID_PLAN_CORE = 0,	/* one CPU per physical core */
+        CPUID_PLAN_L3,		/* packed by shared last level cache */
+};
+
+/*
+ * TSC rate: leaf 0x15/0x16, hypervisor leaf 0x40000010,
+ * or a bounded calibration as last resort
+ */
+enum cpuid_tsc_src_e {
+        CPUID_TSC_SRC_NONE = 0,
+        CPUID_TSC_SRC_LEAF15,
+        CPUID_TSC_SRC_LEAF16,
+        CPUID_TSC_SRC_HYPERVISOR,
+        CPUID_TSC_SRC_CALIBRATED,
+};
+
+struct cpuid_tsc {
+        int invariant;		/* 0x80000007 EDX bit 8 */
+        enum cpuid_tsc_src_e source;
+        uint64_t hz;
+        uint64_t mult;		/* ns = tsc * mult >> shift */
+        unsigned shift;
+};
+
+/*
+ * TSC read ordered against the surrounding code: lfence before
+ * waits for earlier work, lfence after holds later work back
+ */
+static inline uint64_t
+cpuid_rdtsc(void)
+{
+        unsigned lo, hi;
+
+        __asm__ __volatile__ ("lfence\n\t"
+                              "rdtsc\n\t"
+                              "lfence\n\t"
+                              : "=a" (lo), "=d" (hi) : : "memory");
+        return ((uint64_t) hi << 32) | lo;
+}
+
+static inline uint64_t
+cpuid_tsc_to_ns(const struct cpuid_tsc *tsc,
+                uint64_t cycles)
+{
+        return (uint64_t) (((unsigned __int128) cycles * tsc->mult) >> tsc->shift);
+}
+
+/*
+ * x86-64 psABI micro-architecture levels
+ */
+enum cpuid_isa_level_e {
+        CPUID_ISA_NONE = 0,
+        CPUID_ISA_V1,		/* x86-64 baseline */
+        CPUID_ISA_V2,
+        CPUID_ISA_V3,
+        CPUID_ISA_V4,
+
+        CPUID_ISA_NB,
+};
+
+/*
+ * SIMD width preference from the throughput probes
+ */
+enum cpuid_vec_width_e {
+        CPUID_VEC_128 = 0,
+        CPUID_VEC_256,
+        CPUID_VEC_512,
+
+        CPUID_VEC_NB,
+};
+
+struct cpuid_vec_probe {
+        int usable;
+        double flops;		/* double precision flops per TSC cycle */
+        double clock;		/* core clock / TSC clock, after the kernel */
+};
+
+struct cpuid_simd_probe {
+        double base_clock;	/* core clock / TSC clock, scalar only */
+        enum cpuid_vec_width_e preferred;
+        struct cpuid_vec_probe width[CPUID_VEC_NB];
+};
+
+/*
+ * XSAVE area layout, leaf 0xD
+ */
+#define CPUID_XSAVE_MAX		64
+
+struct cpuid_xsave_comp {
+        unsigned size;
+        unsigned offset;		/* standard format, 0 if supervisor */
+        unsigned supervisor:1;		/* IA32_XSS, XSAVES only */
+        unsigned align64:1;		/* 64-byte aligned when compacted */
+        unsigned xfd:1;			/* XFD can trap its first use */
+};
+
+struct cpuid_xsave {
+        uint64_t user_mask;		/* XCR0 bits the CPU supports */
+        uint64_t supervisor_mask;	/* IA32_XSS bits the CPU supports */
+        uint64_t enabled;		/* XCR0 */
+        unsigned size;			/* standard format, XCR0 enabled */
+        unsigned max_size;		/* standard format, all of user_mask */
+        unsigned compacted_size;	/* XSAVEC, XCR0 enabled */
+        unsigned xsaves_size;		/* XSAVES, XCR0 | IA32_XSS enabled */
+        struct cpuid_xsave_comp comp[CPUID_XSAVE_MAX];
+};
+
+/*
+ * memory primitives for flushes, direct stores and waits
+ */
+#define CPUID_MEM_F_CLFLUSH     (1u << 0)
+#define CPUID_MEM_F_CLFLUSHOPT  (1u << 1)
+#define CPUID_MEM_F_CLWB        (1u << 2)
+#define CPUID_MEM_F_CLDEMOTE    (1u << 3)
+#define CPUID_MEM_F_MOVNT       (1u << 4)	/* movnti/movntdq, sse2 */
+#define CPUID_MEM_F_MOVDIRI     (1u << 5)
+#define CPUID_MEM_F_MOVDIR64B   (1u << 6)
+#define CPUID_MEM_F_ENQCMD      (1u << 7)
+#define CPUID_MEM_F_SERIALIZE   (1u << 8)
+#define CPUID_MEM_F_WAITPKG     (1u << 9)	/* umonitor/umwait/tpause */
+#define CPUID_MEM_F_ERMS        (1u << 10)	/* rep movsb/stosb */
+#define CPUID_MEM_F_FSRM        (1u << 11)	/* short rep movsb */
+#define CPUID_MEM_F_FZRM        (1u << 12)	/* zero-length rep movsb */
+#define CPUID_MEM_F_FSRS        (1u << 13)	/* short rep stosb */
+#define CPUID_MEM_F_FSRC        (1u << 14)	/* short rep cmpsb/scasb */
+
+enum cpuid_flush_e {
+        CPUID_FLUSH_NONE = 0,
+        CPUID_FLUSH_CLFLUSH,		/* ordered, evicts */
+        CPUID_FLUSH_CLFLUSHOPT,		/* needs sfence, evicts */
+        CPUID_FLUSH_CLWB,		/* needs sfence, may keep the line */
+};
+
+struct cpuid_mem {
+        unsigned flags;			/* CPUID_MEM_F_* */
+        unsigned clflush_size;		/* bytes, 0 without clflush */
+        enum cpuid_flush_e flush;	/* cheapest write-back flush */
+};
+
+/*
+ * spin-wait: umonitor/umwait and tpause with WAITPKG,
+ * else pause with exponential backoff
+ */
+enum cpuid_wait_e {
+        CPUID_WAIT_PAUSE = 0,
+        CPUID_WAIT_UMWAIT,
+
+        CPUID_WAIT_NB,
+};
+
+struct cpuid_wait {
+        enum cpuid_wait_e method;
+        int waitpkg;			/* detected on the live CPU */
+        int c02;			/* umwait_control/enable_c02 */
+        uint64_t max_time;		/* umwait_control/max_time in ticks, 0: none */
+        uint64_t pause_ticks;		/* TSC ticks per pause */
+        unsigned backoff_max;		/* pauses per round, power of 2 */
+        struct cpuid_tsc tsc;
+};
+
+/*
+ * AMX tile palette 1, leaves 0x1D/0x1E
+ */
+struct cpuid_amx {
+        unsigned palettes;		/* max palette id */
+        unsigned total_bytes;		/* all tiles */
+        unsigned bytes_per_tile;
+        unsigned bytes_per_row;
+        unsigned tiles;			/* tile registers */
+        unsigned max_rows;
+        unsigned tmul_maxk;		/* rows or columns */
+        unsigned tmul_maxn;		/* column bytes */
+};
+
+/*
+ * Resource Director Technology, what resctrl exposes
+ */
+struct cpuid_rdt_cat {
+        unsigned cbm_len;		/* way mask bits, 0 if absent */
+        unsigned shareable;		/* ways used by other agents */
+        unsigned clos;			/* classes of service */
+        unsigned cdp:1;			/* code/data prioritization */
+        unsigned noncontig:1;		/* non-contiguous masks */
+};
+
+struct cpuid_rdt {
+        struct {
+                unsigned rmids;		/* 0 if absent */
+                unsigned scale;		/* bytes per counter unit */
+                unsigned counter_width;
+                unsigned overflow:1;
+                unsigned occupancy:1;
+                unsigned mbm_total:1;
+                unsigned mbm_local:1;
+        } mon;				/* L3 monitoring */
+        struct cpuid_rdt_cat l3;
+        struct cpuid_rdt_cat l2;
+        struct {
+                unsigned max_throttle;	/* Intel, percent */
+                unsigned linear:1;	/* Intel, linear delay scale */
+                unsigned bw_len;	/* AMD, limit bits */
+                unsigned clos;		/* 0 if absent */
+        } mba;
+};
+
+/*
+ * architectural PMU, leaf 0xA
+ */
+enum cpuid_pmu_event_e {
+        CPUID_PMU_EV_CYCLES = 0,	/* leaf 0xA EBX bit order */
+        CPUID_PMU_EV_INSTRUCTIONS,
+        CPUID_PMU_EV_REF_CYCLES,
+        CPUID_PMU_EV_LLC_REFS,
+        CPUID_PMU_EV_LLC_MISSES,
+        CPUID_PMU_EV_BRANCHES,
+        CPUID_PMU_EV_BRANCH_MISSES,
+
+        CPUID_PMU_EV_NB,
+};
+
+struct cpuid_pmu {
+        unsigned version;		/* 0 on AMD */
+        unsigned gp;			/* general-purpose counters */
+        unsigned gp_width;
+        unsigned gp_mask;
+        unsigned fixed;			/* fixed counters */
+        unsigned fixed_width;
+        unsigned fixed_mask;
+        unsigned events;		/* 1 << CPUID_PMU_EV_* available */
+};
+
+/*
+ * per-thread counters through perf_event_open, read with rdpmc
+ * from the perf user page when the kernel allows it
+ */
+#define CPUID_PERF_MAX	CPUID_PMU_EV_NB
+
+struct cpuid_perf_counter {
+        int fd;
+        enum cpuid_pmu_event_e event;
+        void *page;			/* struct perf_event_mmap_page */
+        int rdpmc;			/* 0: read(2) fallback */
+};
+
+struct cpuid_perf {
+        unsigned nb;
+        unsigned rdpmc;			/* counters read with rdpmc */
+        struct cpuid_perf_counter cnt[CPUID_PERF_MAX];
+};
+
+struct cpuid_perf_region {
+        uint64_t calls;
+        uint64_t start[CPUID_PERF_MAX];
+        uint64_t sum[CPUID_PERF_MAX];	/* in cpuid_perf.cnt[] order */
+};
+
+/*
+ * vendor, display family/model/stepping and micro-architecture
+ */
+enum cpuid_vendor_e {
+        CPUID_VENDOR_UNKNOWN = 0,
+        CPUID_VENDOR_INTEL,
+        CPUID_VENDOR_AMD,
+        CPUID_VENDOR_HYGON,
+        CPUID_VENDOR_ZHAOXIN,
+
+        CPUID_VENDOR_NB,
+};
+
+#define CPUID_HINT_SLOW_PDEP            (1u << 0)	/* microcoded pdep/pext */
+#define CPUID_HINT_AVX512_DOWNCLOCK     (1u << 1)	/* 512-bit license drop */
+#define CPUID_HINT_AVX512_HALF          (1u << 2)	/* 512 bits in 2 x 256 */
+#define CPUID_HINT_SPLIT_LOCK_TRAP      (1u << 3)	/* #AC, kernel may throttle */
+
+struct cpuid_uarch {
+        enum cpuid_vendor_e vendor;
+        char vendor_str[13];
+        unsigned signature;		/* leaf 1 EAX */
+        unsigned family;
+        unsigned model;
+        unsigned stepping;
+        const char *name;		/* NULL if not in the table */
+        unsigned hints;			/* CPUID_HINT_* */
+        unsigned rep_movsb_min;		/* bytes, 0: keep vector copies */
+};
+
+/*
+ * hypervisor identified from the 0x40000000 vendor signature
+ */
+enum cpuid_hv_e {
+        CPUID_HV_NONE = 0,	/* bare metal */
+        CPUID_HV_OTHER,		/* hypervisor bit, unknown vendor */
+        CPUID_HV_KVM,
+        CPUID_HV_HYPERV,
+        CPUID_HV_XEN,
+        CPUID_HV_VMWARE,
+        CPUID_HV_TCG,
+        CPUID_HV_BHYVE,
+        CPUID_HV_ACRN,
+        CPUID_HV_VBOX,
+        CPUID_HV_PARALLELS,
+        CPUID_HV_QNX,
+
+        CPUID_HV_NB,
+};
+
+struct cpuid_hv {
+        enum cpuid_hv_e kind;
+        char vendor[13];
+        unsigned max_leaf;
+        unsigned version;	/* Hyper-V, Xen: major << 16 | minor */
+        unsigned build;		/* Hyper-V build number */
+        unsigned spin_retries;	/* Hyper-V, 0xffffffff: never notify */
+        unsigned tsc_khz;	/* 0x40000010, 0 if not reported */
+};
+
+/*
+ * register source of the snapshot: the cpuid instruction,
+ * or a recorded dump replayed on any machine
+ */
+struct cpuid_backend {
+        const char *name;
+        int (*exec)(void *arg, unsigned leaf, unsigned sub_leaf,
+                    unsigned reg[4]);	/* -1: invalid leaf, reg zeroed */
+        uint64_t (*xgetbv)(void *arg);
+        void *arg;
+};
+
+extern const struct cpuid_backend cpuid_backend_live;
+
+extern void cpuid_init(void);
+extern int cpuid_leaf_read(unsigned leaf, unsigned sub_leaf, unsigned reg[4]);
+extern int cpuid_leaf_exec(unsigned leaf, unsigned sub_leaf, unsigned reg[4]);
+extern int cpuid_table_check(void);
+extern int cpuid_snapshot_load(const char *path);
+extern int cpuid_snapshot_write(const char *path);
+extern int cpuid_backend_set(const struct cpuid_backend *be);
+extern const struct cpuid_backend *cpuid_backend_get(void);
+extern int cpuid_leaf_entry(unsigned i, unsigned *leaf, unsigned *sub_leaf,
+                            unsigned reg[4]);
+extern int cpuid_dump_open(struct cpuid_backend *be, const char *path);
+extern void cpuid_dump_close(struct cpuid_backend *be);
+extern void cpuid_dump_write(FILE *fp);
+extern int cpuid_feature_id(const char *name);
+extern const char *cpuid_feature_name(int id);
+extern int cpuid_feature_test(int id);
+extern void cpuid_features_read(struct cpuid_features *set);
+extern void cpuid_features_read_raw(struct cpuid_features *set);
+extern int cpuid_features_exec(struct cpuid_features *set);
+extern void cpuid_features_live(struct cpuid_features *set);
+extern uint64_t cpuid_xcr0(void);
+extern int cpuid_features_from_names(struct cpuid_features *set,
+                                     const char **names);
+/* at most 32 names, see cpuid_features_from_names() for more */
 extern unsigned cpuid_flags_read(const char **names);
+extern unsigned cpuid_cache_read(struct cpuid_cache *caches, unsigned nb);
+extern const struct cpuid_cache *cpuid_cache_find(const struct cpuid_cache *caches,
+                                                  unsigned nb,
+                                                  unsigned level);
+extern struct cpuid_topology *cpuid_topology_scan(void);
+extern void cpuid_topology_free(struct cpuid_topology *topo);
+extern unsigned cpuid_topology_plan(const struct cpuid_topology *topo,
+                                    enum cpuid_plan_e plan,
+                                    int *cpus,
+                                    unsigned nb);
+extern unsigned cpuid_topology_groups(const struct cpuid_topology *topo,
+                                      struct cpuid_core_group *groups,
+                                      unsigned nb);
+extern int cpuid_tsc_read(struct cpuid_tsc *tsc);
+extern const char *cpuid_isa_name(enum cpuid_isa_level_e level);
+extern int cpuid_isa_features(enum cpuid_isa_level_e level,
+                              struct cpuid_features *set);
+extern enum cpuid_isa_level_e cpuid_isa_level(struct cpuid_features *missing);
+extern int cpuid_xsave_read(struct cpuid_xsave *xs);
+extern unsigned cpuid_xsave_size(const struct cpuid_xsave *xs, uint64_t mask,
+                                 int compacted);
+extern unsigned cpuid_xsave_offset(const struct cpuid_xsave *xs, uint64_t mask,
+                                   unsigned i);
+extern void cpuid_mem_read(struct cpuid_mem *mem);
+extern const struct cpuid_wait *cpuid_wait_read(void);
+extern const char *cpuid_wait_name(enum cpuid_wait_e method);
+extern int cpuid_wait_select(enum cpuid_wait_e method);
+extern int cpuid_wait_until(const volatile uint64_t *addr, uint64_t old,
+                            uint64_t ns);
+extern void cpuid_wait_delay(uint64_t ns);
+extern int cpuid_amx_read(struct cpuid_amx *amx);
+extern int cpuid_amx_enable(void);
+extern int cpuid_rdt_read(struct cpuid_rdt *rdt);
+extern int cpuid_pmu_read(struct cpuid_pmu *pmu);
+extern const char *cpuid_pmu_event_name(enum cpuid_pmu_event_e ev);
+extern int cpuid_perf_open(struct cpuid_perf *perf, unsigned mask);
+extern void cpuid_perf_close(struct cpuid_perf *perf);
+extern void cpuid_perf_read(const struct cpuid_perf *perf, uint64_t *counts);
+extern void cpuid_perf_begin(const struct cpuid_perf *perf,
+                             struct cpuid_perf_region *region);
+extern void cpuid_perf_end(const struct cpuid_perf *perf,
+                           struct cpuid_perf_region *region);
+extern int cpuid_uarch_read(struct cpuid_uarch *uarch);
+extern const char *cpuid_vendor_name(enum cpuid_vendor_e vendor);
+extern const struct cpuid_hv *cpuid_hv_read(void);
+extern const char *cpuid_hv_name(enum cpuid_hv_e kind);
+extern int cpuid_hv_flag_test(const char *name);
+extern const char *cpuid_hv_flag_name(unsigned i);
+extern int cpuid_probe_simd(struct cpuid_simd_probe *probe);
+extern void cpuid_probe_mask(const struct cpuid_simd_probe *probe,
+                             struct cpuid_features *set);
+extern const struct cpuid_impl *cpuid_impl_select(const struct cpuid_impl *impls,
+                                                  unsigned nb,
+                                                  const struct cpuid_features *have);
+extern const struct cpuid_impl *cpuid_impl_resolve(const struct cpuid_impl *impls,
+                                                   unsigned nb);
+extern const struct cpuid_impl *cpuid_impl_find(const struct cpuid_impl *impls,
+                                                unsigned nb,
+                                                const char *name);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* !_CPUID_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_TILE		0x0000001dU
+#define CPUID_LEAF_TMUL		0x0000001eU
+
+/* <asm/prctl.h>, not in older headers */
+#define ARCH_GET_XCOMP_PERM	0x1022
+#define ARCH_REQ_XCOMP_PERM	0x1023
+#define XFEATURE_XTILEDATA	18
+
+static int cpuid_amx_perm = -1;
+static pthread_once_t cpuid_amx_once = PTHREAD_ONCE_INIT;
+
+/*
+ * tile geometry of palette 1 from leaves 0x1D and 0x1E.
+ * 0 on success, -1 without amx_tile.
+ */
+int
+cpuid_amx_read(struct cpuid_amx *amx)
+{
+        unsigned reg[4];
+
+        memset(amx, 0, sizeof(*amx));
+        if (!cpuid_feature_test(cpuid_feature_id("amx_tile")) ||
+            cpuid_leaf_read(CPUID_LEAF_TILE, 0, reg))
+                return -1;
+
+        amx->palettes = reg[0];
+        if (amx->palettes < 1 || cpuid_leaf_read(CPUID_LEAF_TILE, 1, reg))
+                return -1;
+
+        amx->total_bytes    = reg[0] & 0xffff;
+        amx->bytes_per_tile = reg[0] >> 16;
+        amx->bytes_per_row  = reg[1] & 0xffff;
+        amx->tiles          = reg[1] >> 16;
+        amx->max_rows       = reg[2] & 0xffff;
+
+        if (!cpuid_leaf_read(CPUID_LEAF_TMUL, 0, reg)) {
+                amx->tmul_maxk = reg[1] & 0xff;
+                amx->tmul_maxn = (reg[1] >> 8) & 0xffff;
+        }
+        return 0;
+}
+
+static void
+cpuid_amx_request(void)
+{
+        unsigned long bitmask = 0;
+
+        if (!cpuid_feature_test(cpuid_feature_id("amx_tile")) ||
+            cpuid_backend_get() != &cpuid_backend_live) {
+                cpuid_amx_perm = -1;
+                return;
+        }
+
+        /* EINVAL on kernels before 5.16 or without AMX support */
+        if (syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA) ||
+            syscall(SYS_arch_prctl, ARCH_GET_XCOMP_PERM, &bitmask) ||
+            !(bitmask & (1UL << XFEATURE_XTILEDATA))) {
+                cpuid_amx_perm = -1;
+                return;
+        }
+        cpuid_amx_perm = 0;
+}
+
+/*
+ * ask the kernel for the tile data state of the whole process.
+ * must precede the first tile instruction, which is otherwise
+ * fatal. 0 if tiles are usable in this process.
+ */
+int
+cpuid_amx_enable(void)
+{
+        pthread_once(&cpuid_amx_once, cpuid_amx_request);
+        return cpuid_amx_perm;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_CACHE	0x00000004U
+#define CPUID_LEAF_CACHE_AMD	0x8000001dU
+#define CPUID_LEAF_L1_AMD	0x80000005U
+#define CPUID_LEAF_L2_AMD	0x80000006U
+
+/*
+ * leaf 4 and 0x8000001D share the layout
+ */
+static unsigned
+cpuid_cache_walk(unsigned leaf,
+                 struct cpuid_cache *caches,
+                 unsigned nb)
+{
+        unsigned n = 0;
+        unsigned reg[4];
+
+        for (unsigned sub_leaf = 0;
+             n < nb && !cpuid_leaf_read(leaf, sub_leaf, reg);
+             sub_leaf++) {
+                struct cpuid_cache *cache = &caches[n];
+                unsigned type = reg[0] & 0x1f;
+
+                if (!type)
+                        break;
+
+                cache->level      = (reg[0] >> 5) & 0x7;
+                cache->type       = (enum cpuid_cache_type_e) type;
+                cache->line_size  = (reg[1] & 0xfff) + 1;
+                cache->partitions = ((reg[1] >> 12) & 0x3ff) + 1;
+                cache->ways       = ((reg[1] >> 22) & 0x3ff) + 1;
+                cache->sets       = reg[2] + 1;
+                cache->shared     = ((reg[0] >> 14) & 0xfff) + 1;
+                cache->size       = cache->line_size * cache->partitions *
+                                    cache->ways * cache->sets;
+                cache->flags      = 0;
+                if (reg[0] & (1u << 8))
+                        cache->flags |= CPUID_CACHE_F_SELF_INIT;
+                if (reg[0] & (1u << 9))
+                        cache->flags |= CPUID_CACHE_F_FULLY_ASSOC;
+                if (reg[3] & (1u << 1))
+                        cache->flags |= CPUID_CACHE_F_INCLUSIVE;
+                if (reg[3] & (1u << 2))
+                        cache->flags |= CPUID_CACHE_F_COMPLEX_INDEX;
+                n++;
+        }
+        return n;
+}
+
+/* associativity as 0x80000005 encodes fully associative */
+#define CPUID_CACHE_WAYS_FULL   0xffU
+
+/*
+ * L2/L3 associativity encoding of 0x80000006 (APM vol. 3),
+ * to the L1 encoding of 0x80000005. reserved codes: 0
+ */
+static unsigned
+cpuid_cache_amd_ways(unsigned code)
+{
+        static const unsigned ways[16] = {
+                [0x1] = 1,
+                [0x2] = 2,
+                [0x4] = 4,
+                [0x6] = 8,
+                [0x8] = 16,
+                [0xa] = 32,
+                [0xb] = 48,
+                [0xc] = 64,
+                [0xd] = 96,
+                [0xe] = 128,
+                [0xf] = CPUID_CACHE_WAYS_FULL,
+        };
+
+        return ways[code & 0xf];
+}
+
+static void
+cpuid_cache_amd_set(struct cpuid_cache *cache,
+                    unsigned level,
+                    enum cpuid_cache_type_e type,
+                    unsigned size,
+                    unsigned ways,
+                    unsigned line_size)
+{
+        cache->level      = level;
+        cache->type       = type;
+        cache->size       = size;
+        cache->line_size  = line_size;
+        cache->ways       = ways;
+        cache->partitions = 1;
+        cache->sets       = 0;
+        cache->shared     = 0;	/* not reported */
+        cache->flags      = 0;
+        if (ways == CPUID_CACHE_WAYS_FULL) {
+                /* one set holding every line */
+                cache->ways = line_size ? size / line_size : 0;
+                cache->sets = 1;
+                cache->flags |= CPUID_CACHE_F_FULLY_ASSOC;
+        } else if (ways && line_size) {
+                cache->sets = size / (ways * line_size);
+        }
+}
+
+/*
+ * legacy AMD leaves, without TOPOEXT
+ */
+static unsigned
+cpuid_cache_amd_legacy(struct cpuid_cache *caches,
+                       unsigned nb)
+{
+        unsigned l1[4], l2[4];
+        unsigned n = 0;
+
+        if (cpuid_leaf_read(CPUID_LEAF_L1_AMD, 0, l1))
+                return 0;
+
+        if (n < nb && (l1[2] >> 24))
+                cpuid_cache_amd_set(&caches[n++], 1, CPUID_CACHE_DATA,
+                                    (l1[2] >> 24) << 10,
+                                    (l1[2] >> 16) & 0xff, l1[2] & 0xff);
+        if (n < nb && (l1[3] >> 24))
+                cpuid_cache_amd_set(&caches[n++], 1, CPUID_CACHE_INST,
+                                    (l1[3] >> 24) << 10,
+                                    (l1[3] >> 16) & 0xff, l1[3] & 0xff);
+
+        if (cpuid_leaf_read(CPUID_LEAF_L2_AMD, 0, l2))
+                return n;
+
+        if (n < nb && (l2[2] >> 16))
+                cpuid_cache_amd_set(&caches[n++], 2, CPUID_CACHE_UNIFIED,
+                                    (l2[2] >> 16) << 10,
+                                    cpuid_cache_amd_ways(l2[2] >> 12),
+                                    l2[2] & 0xff);
+        if (n < nb && (l2[3] >> 18))
+                cpuid_cache_amd_set(&caches[n++], 3, CPUID_CACHE_UNIFIED,
+                                    (l2[3] >> 18) << 19,
+                                    cpuid_cache_amd_ways(l2[3] >> 12),
+                                    l2[3] & 0xff);
+        return n;
+}
+
+/*
+ * fill caches[] from the deterministic cache parameters,
+ * returns the number of entries
+ */
+unsigned
+cpuid_cache_read(struct cpuid_cache *caches,
+                 unsigned nb)
+{
+        unsigned n;
+
+        n = cpuid_cache_walk(CPUID_LEAF_CACHE, caches, nb);
+        if (!n)
+                n = cpuid_cache_walk(CPUID_LEAF_CACHE_AMD, caches, nb);
+        if (!n)
+                n = cpuid_cache_amd_legacy(caches, nb);
+        return n;
+}
+
+/*
+ * data or unified cache of level, NULL if none
+ */
+const struct cpuid_cache *
+cpuid_cache_find(const struct cpuid_cache *caches,
+                 unsigned nb,
+                 unsigned level)
+{
+        for (unsigned i = 0; i < nb; i++) {
+                if (caches[i].level == level &&
+                    (caches[i].type == CPUID_CACHE_DATA ||
+                     caches[i].type == CPUID_CACHE_UNIFIED))
+                        return &caches[i];
+        }
+        return NULL;
+}
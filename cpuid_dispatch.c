@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+#define CPUID_MASK_ENV		"CPUID_MASK"
+#define CPUID_NAME_MAX		32
+
+static const char *cpuid_amx_names[] = {
+        "amx_tile", "amx_int8", "amx_bf16", "amx_fp16", "amx_complex",
+        NULL,	/* terminator */
+};
+
+/*
+ * features hidden from dispatch by CPUID_MASK="avx512f,avx2",
+ * lets test runs force every fallback without other hardware
+ */
+static void
+cpuid_mask_env(struct cpuid_features *mask)
+{
+        const char *env = getenv(CPUID_MASK_ENV);
+
+        cpuid_features_zero(mask);
+        while (env && *env) {
+                char name[CPUID_NAME_MAX];
+                size_t len = strcspn(env, ", ");
+
+                if (len && len < sizeof(name)) {
+                        memcpy(name, env, len);
+                        name[len] = '\0';
+                        cpuid_features_set(mask, cpuid_feature_id(name));
+                }
+                env += len;
+                env += strspn(env, ", ");
+        }
+}
+
+/*
+ * highest priority impl whose features are all in have,
+ * the first one wins a tie. have NULL: this CPU minus CPUID_MASK,
+ * and AMX impls only once the kernel granted the tile state.
+ */
+const struct cpuid_impl *
+cpuid_impl_select(const struct cpuid_impl *impls,
+                  unsigned nb,
+                  const struct cpuid_features *have)
+{
+        const struct cpuid_impl *best = NULL;
+        struct cpuid_features cpu;
+        struct cpuid_features amx;
+
+        cpuid_features_zero(&amx);
+        if (!have) {
+                struct cpuid_features mask;
+
+                cpuid_features_read(&cpu);
+                cpuid_mask_env(&mask);
+                cpuid_features_andnot(&cpu, &cpu, &mask);
+                cpuid_features_from_names(&amx, cpuid_amx_names);
+                have = &cpu;
+        }
+
+        for (unsigned i = 0; i < nb; i++) {
+                struct cpuid_features want;
+
+                if (impls[i].features &&
+                    cpuid_features_from_names(&want, impls[i].features))
+                        continue;	/* unknown feature, never usable */
+                if (!impls[i].features)
+                        cpuid_features_zero(&want);
+
+                if (!cpuid_features_has_all(have, &want))
+                        continue;
+                if (cpuid_features_has_any(&want, &amx) && cpuid_amx_enable())
+                        continue;
+                if (!best || impls[i].priority > best->priority)
+                        best = &impls[i];
+        }
+        return best;
+}
+
+/*
+ * cpuid_impl_select() without side effects, for ifunc resolvers:
+ * cpuid as this CPU reports it, no CPUID_MASK, no snapshot,
+ * AMX impls left out rather than asking the kernel for the tiles
+ */
+const struct cpuid_impl *
+cpuid_impl_resolve(const struct cpuid_impl *impls,
+                   unsigned nb)
+{
+        struct cpuid_features cpu;
+        struct cpuid_features amx;
+
+        cpuid_features_live(&cpu);
+        cpuid_features_from_names(&amx, cpuid_amx_names);
+        cpuid_features_andnot(&cpu, &cpu, &amx);
+        return cpuid_impl_select(impls, nb, &cpu);
+}
+
+const struct cpuid_impl *
+cpuid_impl_find(const struct cpuid_impl *impls,
+                unsigned nb,
+                const char *name)
+{
+        for (unsigned i = 0; i < nb; i++) {
+                if (!strcmp(impls[i].name, name))
+                        return &impls[i];
+        }
+        return NULL;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+#define CPUID_XSAVE_LEAF	0x0000000dU
+
+struct cpuid_dump_ent {
+        unsigned leaf;
+        unsigned sub_leaf;
+        unsigned reg[4];
+};
+
+struct cpuid_dump {
+        unsigned nb;
+        unsigned max;
+        uint64_t xcr0;
+        struct cpuid_dump_ent *ent;
+};
+
+static const struct cpuid_dump_ent *
+cpuid_dump_find(const struct cpuid_dump *dump,
+                unsigned leaf,
+                unsigned sub_leaf)
+{
+        for (unsigned i = 0; i < dump->nb; i++) {
+                if (dump->ent[i].leaf == leaf &&
+                    dump->ent[i].sub_leaf == sub_leaf)
+                        return &dump->ent[i];
+        }
+        return NULL;
+}
+
+/*
+ * not recorded reads as all zero, an invalid leaf
+ */
+static int
+cpuid_dump_exec(void *arg,
+                unsigned leaf,
+                unsigned sub_leaf,
+                unsigned reg[4])
+{
+        const struct cpuid_dump_ent *ent = cpuid_dump_find(arg, leaf, sub_leaf);
+
+        if (!ent) {
+                memset(reg, 0, 4 * sizeof(reg[0]));
+                return -1;
+        }
+        memcpy(reg, ent->reg, sizeof(ent->reg));
+
+        /* all Zero then invalid */
+        return (reg[0] | reg[1] | reg[2] | reg[3]) ? 0 : -1;
+}
+
+static uint64_t
+cpuid_dump_xgetbv(void *arg)
+{
+        const struct cpuid_dump *dump = arg;
+
+        return dump->xcr0;
+}
+
+static int
+cpuid_dump_add(struct cpuid_dump *dump,
+               const struct cpuid_dump_ent *ent)
+{
+        if (cpuid_dump_find(dump, ent->leaf, ent->sub_leaf))
+                return 0;
+
+        if (dump->nb == dump->max) {
+                unsigned max = dump->max ? dump->max * 2 : 64;
+                struct cpuid_dump_ent *p;
+
+                p = realloc(dump->ent, max * sizeof(*p));
+                if (!p)
+                        return -1;
+                dump->ent = p;
+                dump->max = max;
+        }
+        dump->ent[dump->nb++] = *ent;
+        return 0;
+}
+
+/*
+ * replay backend from a text dump, the "cpuid -r" layout:
+ *    0x00000007 0x00: eax=0x00000002 ebx=0xf1bf27eb ecx=... edx=...
+ * only the first CPU is read. XCR0 is taken as every user state
+ * of leaf 0xD, the dump does not record it.
+ */
+int
+cpuid_dump_open(struct cpuid_backend *be,
+                const char *path)
+{
+        struct cpuid_dump *dump;
+        const struct cpuid_dump_ent *xsave;
+        char line[256];
+        FILE *fp;
+        int cpus = 0;
+
+        fp = fopen(path, "re");
+        if (!fp)
+                return -1;
+        dump = calloc(1, sizeof(*dump));
+        if (!dump) {
+                fclose(fp);
+                return -1;
+        }
+
+        while (fgets(line, sizeof(line), fp)) {
+                struct cpuid_dump_ent ent;
+
+                if (!strncmp(line, "CPU ", 4) && cpus++)
+                        break;
+                if (sscanf(line, " 0x%x 0x%x: eax=0x%x ebx=0x%x ecx=0x%x edx=0x%x",
+                           &ent.leaf, &ent.sub_leaf, &ent.reg[0], &ent.reg[1],
+                           &ent.reg[2], &ent.reg[3]) != 6)
+                        continue;
+                if (cpuid_dump_add(dump, &ent))
+                        goto err;
+        }
+        fclose(fp);
+        if (!dump->nb)
+                goto err_free;
+
+        xsave = cpuid_dump_find(dump, CPUID_XSAVE_LEAF, 0);
+        if (xsave)
+                dump->xcr0 = ((uint64_t) xsave->reg[3] << 32) | xsave->reg[0];
+
+        be->name = "dump";
+        be->exec = cpuid_dump_exec;
+        be->xgetbv = cpuid_dump_xgetbv;
+        be->arg = dump;
+        return 0;
+
+ err:
+        fclose(fp);
+ err_free:
+        free(dump->ent);
+        free(dump);
+        return -1;
+}
+
+void
+cpuid_dump_close(struct cpuid_backend *be)
+{
+        struct cpuid_dump *dump = be->arg;
+
+        if (dump) {
+                free(dump->ent);
+                free(dump);
+        }
+        be->arg = NULL;
+}
+
+/*
+ * the snapshot in use, in the layout cpuid_dump_open() reads
+ */
+void
+cpuid_dump_write(FILE *fp)
+{
+        unsigned leaf, sub_leaf, reg[4];
+
+        fprintf(fp, "CPU 0:\n");
+        for (unsigned i = 0; !cpuid_leaf_entry(i, &leaf, &sub_leaf, reg); i++)
+                fprintf(fp, "   0x%08x 0x%02x: eax=0x%08x ebx=0x%08x ecx=0x%08x edx=0x%08x\n",
+                        leaf, sub_leaf, reg[0], reg[1], reg[2], reg[3]);
+}
@@ -0,0 +1,256 @@
+#ifndef _CPUID_FEATURE_H_
+#define _CPUID_FEATURE_H_
+
+/*
+ * every feature bit cpuid_attr[] decodes, in leaf order:
+ * X(id, name, leaf, sub_leaf, register, bit, XCR0 state, macro)
+ * sub_leaf 0 also for leaves without sub-leaves, state 0: none,
+ * macro: the compiler's predefined macro for the ISA, 0: none.
+ * the order is the feature id, append rather than insert,
+ * and add the id to cpuid_name_index[] in cpuid.c.
+ */
+#define CPUID_FEATURE_LIST(X)                                                                                                         \
+        /* 0x00000001.0 EDX */                                                                                                        \
+        X(FPU,                 "fpu",                 0x00000001, 0, EDX,  0, 0,                 __x86_64__)                          \
+        X(VME,                 "vme",                 0x00000001, 0, EDX,  1, 0,                 0)                                   \
+        X(DE,                  "de",                  0x00000001, 0, EDX,  2, 0,                 0)                                   \
+        X(PSE,                 "pse",                 0x00000001, 0, EDX,  3, 0,                 0)                                   \
+        X(TSC,                 "tsc",                 0x00000001, 0, EDX,  4, 0,                 0)                                   \
+        X(MSR,                 "msr",                 0x00000001, 0, EDX,  5, 0,                 0)                                   \
+        X(PAE,                 "pae",                 0x00000001, 0, EDX,  6, 0,                 0)                                   \
+        X(MCE,                 "mce",                 0x00000001, 0, EDX,  7, 0,                 0)                                   \
+        X(CX8,                 "cx8",                 0x00000001, 0, EDX,  8, 0,                 __x86_64__)                          \
+        X(APIC,                "apic",                0x00000001, 0, EDX,  9, 0,                 0)                                   \
+        X(SEP,                 "sep",                 0x00000001, 0, EDX, 11, 0,                 0)                                   \
+        X(MTRR,                "mtrr",                0x00000001, 0, EDX, 12, 0,                 0)                                   \
+        X(PGE,                 "pge",                 0x00000001, 0, EDX, 13, 0,                 0)                                   \
+        X(MCA,                 "mca",                 0x00000001, 0, EDX, 14, 0,                 0)                                   \
+        X(CMOV,                "cmov",                0x00000001, 0, EDX, 15, 0,                 __x86_64__)                          \
+        X(PAT,                 "pat",                 0x00000001, 0, EDX, 16, 0,                 0)                                   \
+        X(PSE_36,              "pse-36",              0x00000001, 0, EDX, 17, 0,                 0)                                   \
+        X(PSN,                 "psn",                 0x00000001, 0, EDX, 18, 0,                 0)                                   \
+        X(CLFSH,               "clfsh",               0x00000001, 0, EDX, 19, 0,                 0)                                   \
+        X(DS,                  "ds",                  0x00000001, 0, EDX, 21, 0,                 0)                                   \
+        X(ACPI,                "acpi",                0x00000001, 0, EDX, 22, 0,                 0)                                   \
+        X(MMX,                 "mmx",                 0x00000001, 0, EDX, 23, 0,                 __MMX__)                             \
+        X(FXSR,                "fxsr",                0x00000001, 0, EDX, 24, 0,                 __FXSR__)                            \
+        X(SSE,                 "sse",                 0x00000001, 0, EDX, 25, 0,                 __SSE__)                             \
+        X(SSE2,                "sse2",                0x00000001, 0, EDX, 26, 0,                 __SSE2__)                            \
+        X(SS,                  "ss",                  0x00000001, 0, EDX, 27, 0,                 0)                                   \
+        X(HTT,                 "htt",                 0x00000001, 0, EDX, 28, 0,                 0)                                   \
+        X(TM,                  "tm",                  0x00000001, 0, EDX, 29, 0,                 0)                                   \
+        X(IA64,                "ia64",                0x00000001, 0, EDX, 30, 0,                 0)                                   \
+        X(PBE,                 "pbe",                 0x00000001, 0, EDX, 31, 0,                 0)                                   \
+        /* 0x00000001.0 ECX */                                                                                                        \
+        X(SSE3,                "sse3",                0x00000001, 0, ECX,  0, 0,                 __SSE3__)                            \
+        X(PCLMULQDQ,           "pclmulqdq",           0x00000001, 0, ECX,  1, 0,                 __PCLMUL__)                          \
+        X(DTES64,              "dtes64",              0x00000001, 0, ECX,  2, 0,                 0)                                   \
+        X(MONITOR,             "monitor",             0x00000001, 0, ECX,  3, 0,                 0)                                   \
+        X(DS_CPL,              "ds-cpl",              0x00000001, 0, ECX,  4, 0,                 0)                                   \
+        X(VMX,                 "vmx",                 0x00000001, 0, ECX,  5, 0,                 0)                                   \
+        X(SMX,                 "smx",                 0x00000001, 0, ECX,  6, 0,                 0)                                   \
+        X(EST,                 "est",                 0x00000001, 0, ECX,  7, 0,                 0)                                   \
+        X(TM2,                 "tm2",                 0x00000001, 0, ECX,  8, 0,                 0)                                   \
+        X(SSSE3,               "ssse3",               0x00000001, 0, ECX,  9, 0,                 __SSSE3__)                           \
+        X(CNXT_ID,             "cnxt-id",             0x00000001, 0, ECX, 10, 0,                 0)                                   \
+        X(SDBG,                "sdbg",                0x00000001, 0, ECX, 11, 0,                 0)                                   \
+        X(FMA,                 "fma",                 0x00000001, 0, ECX, 12, CPUID_XCR0_AVX,    __FMA__)                             \
+        X(CX16,                "cx16",                0x00000001, 0, ECX, 13, 0,                 __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) \
+        X(XTPR,                "xtpr",                0x00000001, 0, ECX, 14, 0,                 0)                                   \
+        X(PDCM,                "pdcm",                0x00000001, 0, ECX, 15, 0,                 0)                                   \
+        X(PCID,                "pcid",                0x00000001, 0, ECX, 17, 0,                 0)                                   \
+        X(DCA,                 "dca",                 0x00000001, 0, ECX, 18, 0,                 0)                                   \
+        X(SSE4_1,              "sse4.1",              0x00000001, 0, ECX, 19, 0,                 __SSE4_1__)                          \
+        X(SSE4_2,              "sse4.2",              0x00000001, 0, ECX, 20, 0,                 __SSE4_2__)                          \
+        X(X2APIC,              "x2apic",              0x00000001, 0, ECX, 21, 0,                 0)                                   \
+        X(MOVBE,               "movbe",               0x00000001, 0, ECX, 22, 0,                 __MOVBE__)                           \
+        X(POPCNT,              "popcnt",              0x00000001, 0, ECX, 23, 0,                 __POPCNT__)                          \
+        X(TSC_DEADLINE,        "tsc-deadline",        0x00000001, 0, ECX, 24, 0,                 0)                                   \
+        X(AES,                 "aes",                 0x00000001, 0, ECX, 25, 0,                 __AES__)                             \
+        X(XSAVE,               "xsave",               0x00000001, 0, ECX, 26, 0,                 __XSAVE__)                           \
+        X(OSXSAVE,             "osxsave",             0x00000001, 0, ECX, 27, 0,                 0)                                   \
+        X(AVX,                 "avx",                 0x00000001, 0, ECX, 28, CPUID_XCR0_AVX,    __AVX__)                             \
+        X(F16C,                "f16c",                0x00000001, 0, ECX, 29, CPUID_XCR0_AVX,    __F16C__)                            \
+        X(RDRND,               "rdrnd",               0x00000001, 0, ECX, 30, 0,                 __RDRND__)                           \
+        X(HYPERVISOR,          "hypervisor",          0x00000001, 0, ECX, 31, 0,                 0)                                   \
+        /* 0x00000007.0 EBX */                                                                                                        \
+        X(FSGSBASE,            "fsgsbase",            0x00000007, 0, EBX,  0, 0,                 __FSGSBASE__)                        \
+        X(TSC_ADJUST,          "tsc_adjust",          0x00000007, 0, EBX,  1, 0,                 0)                                   \
+        X(SGX,                 "sgx",                 0x00000007, 0, EBX,  2, 0,                 __SGX__)                             \
+        X(BMI1,                "bmi1",                0x00000007, 0, EBX,  3, 0,                 __BMI__)                             \
+        X(HLE,                 "hle",                 0x00000007, 0, EBX,  4, 0,                 __HLE__)                             \
+        X(AVX2,                "avx2",                0x00000007, 0, EBX,  5, CPUID_XCR0_AVX,    __AVX2__)                            \
+        X(SMEP,                "smep",                0x00000007, 0, EBX,  7, 0,                 0)                                   \
+        X(BMI2,                "bmi2",                0x00000007, 0, EBX,  8, 0,                 __BMI2__)                            \
+        X(ERMS,                "erms",                0x00000007, 0, EBX,  9, 0,                 0)                                   \
+        X(INVPCID,             "invpcid",             0x00000007, 0, EBX, 10, 0,                 0)                                   \
+        X(RTM,                 "rtm",                 0x00000007, 0, EBX, 11, 0,                 __RTM__)                             \
+        X(PQM,                 "pqm",                 0x00000007, 0, EBX, 12, 0,                 0)                                   \
+        X(MPX,                 "mpx",                 0x00000007, 0, EBX, 14, 0,                 0)                                   \
+        X(PQ,                  "pq",                  0x00000007, 0, EBX, 15, 0,                 0)                                   \
+        X(AVX512F,             "avx512f",             0x00000007, 0, EBX, 16, CPUID_XCR0_AVX512, __AVX512F__)                         \
+        X(AVX512DQ,            "avx512dq",            0x00000007, 0, EBX, 17, CPUID_XCR0_AVX512, __AVX512DQ__)                        \
+        X(RDSEED,              "rdseed",              0x00000007, 0, EBX, 18, 0,                 __RDSEED__)                          \
+        X(ADX,                 "adx",                 0x00000007, 0, EBX, 19, 0,                 __ADX__)                             \
+        X(SMAP,                "smap",                0x00000007, 0, EBX, 20, 0,                 0)                                   \
+        X(AVX512IFMA,          "avx512ifma",          0x00000007, 0, EBX, 21, CPUID_XCR0_AVX512, __AVX512IFMA__)                      \
+        X(PCOMMIT,             "pcommit",             0x00000007, 0, EBX, 22, 0,                 0)                                   \
+        X(CLFLUSHOPT,          "clflushopt",          0x00000007, 0, EBX, 23, 0,                 __CLFLUSHOPT__)                      \
+        X(CLWB,                "clwb",                0x00000007, 0, EBX, 24, 0,                 __CLWB__)                            \
+        X(INTEL_PT,            "intel_pt",            0x00000007, 0, EBX, 25, 0,                 0)                                   \
+        X(AVX512PF,            "avx512pf",            0x00000007, 0, EBX, 26, CPUID_XCR0_AVX512, __AVX512PF__)                        \
+        X(AVX512ER,            "avx512er",            0x00000007, 0, EBX, 27, CPUID_XCR0_AVX512, __AVX512ER__)                        \
+        X(AVX512CD,            "avx512cd",            0x00000007, 0, EBX, 28, CPUID_XCR0_AVX512, __AVX512CD__)                        \
+        X(SHA,                 "sha",                 0x00000007, 0, EBX, 29, 0,                 __SHA__)                             \
+        X(AVX512BW,            "avx512bw",            0x00000007, 0, EBX, 30, CPUID_XCR0_AVX512, __AVX512BW__)                        \
+        X(AVX512VL,            "avx512vl",            0x00000007, 0, EBX, 31, CPUID_XCR0_AVX512, __AVX512VL__)                        \
+        /* 0x00000007.0 ECX */                                                                                                        \
+        X(PREFETCHWT1,         "prefetchwt1",         0x00000007, 0, ECX,  0, 0,                 __PREFETCHWT1__)                     \
+        X(AVX512VBMI,          "avx512vbmi",          0x00000007, 0, ECX,  1, CPUID_XCR0_AVX512, __AVX512VBMI__)                      \
+        X(UMIP,                "umip",                0x00000007, 0, ECX,  2, 0,                 0)                                   \
+        X(PKU,                 "pku",                 0x00000007, 0, ECX,  3, 0,                 __PKU__)                             \
+        X(OSPKE,               "ospke",               0x00000007, 0, ECX,  4, 0,                 0)                                   \
+        X(AVX512_VBMI2,        "avx512_vbmi2",        0x00000007, 0, ECX,  6, CPUID_XCR0_AVX512, __AVX512VBMI2__)                     \
+        X(GFNI,                "gfni",                0x00000007, 0, ECX,  8, 0,                 __GFNI__)                            \
+        X(VAES,                "vaes",                0x00000007, 0, ECX,  9, CPUID_XCR0_AVX,    __VAES__)                            \
+        X(VPCLMULQDQ,          "vpclmulqdq",          0x00000007, 0, ECX, 10, CPUID_XCR0_AVX,    __VPCLMULQDQ__)                      \
+        X(AVX512_VNNI,         "avx512_vnni",         0x00000007, 0, ECX, 11, CPUID_XCR0_AVX512, __AVX512VNNI__)                      \
+        X(AVX512_BITALG,       "avx512_bitalg",       0x00000007, 0, ECX, 12, CPUID_XCR0_AVX512, __AVX512BITALG__)                    \
+        X(AVX512VPOPCNTDQ,     "avx512vpopcntdq",     0x00000007, 0, ECX, 14, CPUID_XCR0_AVX512, __AVX512VPOPCNTDQ__)                 \
+        X(LA57,                "la57",                0x00000007, 0, ECX, 16, 0,                 0)                                   \
+        X(RDPID,               "rdpid",               0x00000007, 0, ECX, 22, 0,                 __RDPID__)                           \
+        X(MOVDIRI,             "movdiri",             0x00000007, 0, ECX, 27, 0,                 __MOVDIRI__)                         \
+        X(MOVDIR64B,           "movdir64b",           0x00000007, 0, ECX, 28, 0,                 __MOVDIR64B__)                       \
+        X(SGX_LC,              "sgx_lc",              0x00000007, 0, ECX, 30, 0,                 0)                                   \
+        /* 0x00000007.0 EDX */                                                                                                        \
+        X(AVX512_4VNNIW,       "avx512_4vnniw",       0x00000007, 0, EDX,  2, CPUID_XCR0_AVX512, __AVX5124VNNIW__)                    \
+        X(AVX512_4FMAPS,       "avx512_4fmaps",       0x00000007, 0, EDX,  3, CPUID_XCR0_AVX512, __AVX5124FMAPS__)                    \
+        X(AVX512_VP2INTERSECT, "avx512_vp2intersect", 0x00000007, 0, EDX,  8, CPUID_XCR0_AVX512, __AVX512VP2INTERSECT__)              \
+        X(HYBRID,              "hybrid",              0x00000007, 0, EDX, 15, 0,                 0)                                   \
+        X(AMX_BF16,            "amx_bf16",            0x00000007, 0, EDX, 22, CPUID_XCR0_AMX,    __AMX_BF16__)                        \
+        X(AVX512_FP16,         "avx512_fp16",         0x00000007, 0, EDX, 23, CPUID_XCR0_AVX512, __AVX512FP16__)                      \
+        X(AMX_TILE,            "amx_tile",            0x00000007, 0, EDX, 24, CPUID_XCR0_AMX,    __AMX_TILE__)                        \
+        X(AMX_INT8,            "amx_int8",            0x00000007, 0, EDX, 25, CPUID_XCR0_AMX,    __AMX_INT8__)                        \
+        /* 0x00000007.1 EAX */                                                                                                        \
+        X(AVX_VNNI,            "avx_vnni",            0x00000007, 1, EAX,  4, CPUID_XCR0_AVX,    __AVXVNNI__)                         \
+        X(AVX512_BF16,         "avx512_bf16",         0x00000007, 1, EAX,  5, CPUID_XCR0_AVX512, __AVX512BF16__)                      \
+        X(CMPCCXADD,           "cmpccxadd",           0x00000007, 1, EAX,  7, 0,                 __CMPCCXADD__)                       \
+        X(AMX_FP16,            "amx_fp16",            0x00000007, 1, EAX, 21, CPUID_XCR0_AMX,    __AMX_FP16__)                        \
+        X(AVX_IFMA,            "avx_ifma",            0x00000007, 1, EAX, 23, CPUID_XCR0_AVX,    __AVXIFMA__)                         \
+        /* 0x00000007.1 EDX */                                                                                                        \
+        X(AVX_VNNI_INT8,       "avx_vnni_int8",       0x00000007, 1, EDX,  4, CPUID_XCR0_AVX,    __AVXVNNIINT8__)                     \
+        X(AVX_NE_CONVERT,      "avx_ne_convert",      0x00000007, 1, EDX,  5, CPUID_XCR0_AVX,    __AVXNECONVERT__)                    \
+        X(AMX_COMPLEX,         "amx_complex",         0x00000007, 1, EDX,  8, CPUID_XCR0_AMX,    __AMX_COMPLEX__)                     \
+        X(AVX_VNNI_INT16,      "avx_vnni_int16",      0x00000007, 1, EDX, 10, CPUID_XCR0_AVX,    __AVXVNNIINT16__)                    \
+        X(AVX10,               "avx10",               0x00000007, 1, EDX, 19, CPUID_XCR0_AVX512, 0)                                   \
+        /* 0x0000000d.1 EAX */                                                                                                        \
+        X(XSAVEOPT,            "xsaveopt",            0x0000000d, 1, EAX,  0, 0,                 __XSAVEOPT__)                        \
+        X(XSAVEC,              "xsavec",              0x0000000d, 1, EAX,  1, 0,                 __XSAVEC__)                          \
+        X(XGETBV1,             "xgetbv1",             0x0000000d, 1, EAX,  2, 0,                 0)                                   \
+        X(XSAVES,              "xsaves",              0x0000000d, 1, EAX,  3, 0,                 __XSAVES__)                          \
+        X(XFD,                 "xfd",                 0x0000000d, 1, EAX,  4, 0,                 0)                                   \
+        /* 0x80000001.0 ECX */                                                                                                        \
+        X(LAHF_LM,             "lahf_lm",             0x80000001, 0, ECX,  0, 0,                 __LAHF_SAHF__)                       \
+        X(CMP_LEGACY,          "cmp_legacy",          0x80000001, 0, ECX,  1, 0,                 0)                                   \
+        X(SVM,                 "svm",                 0x80000001, 0, ECX,  2, 0,                 0)                                   \
+        X(EXTAPIC,             "extapic",             0x80000001, 0, ECX,  3, 0,                 0)                                   \
+        X(CR8_LEGACY,          "cr8_legacy",          0x80000001, 0, ECX,  4, 0,                 0)                                   \
+        X(LZCNT,               "lzcnt",               0x80000001, 0, ECX,  5, 0,                 __LZCNT__)                           \
+        X(SSE4A,               "sse4a",               0x80000001, 0, ECX,  6, 0,                 __SSE4A__)                           \
+        X(MISALIGNSSE,         "misalignsse",         0x80000001, 0, ECX,  7, 0,                 0)                                   \
+        X(PREFETCHW,           "prefetchw",           0x80000001, 0, ECX,  8, 0,                 __PRFCHW__)                          \
+        X(OSVW,                "osvw",                0x80000001, 0, ECX,  9, 0,                 0)                                   \
+        X(IBS,                 "ibs",                 0x80000001, 0, ECX, 10, 0,                 0)                                   \
+        X(XOP,                 "xop",                 0x80000001, 0, ECX, 11, CPUID_XCR0_AVX,    __XOP__)                             \
+        X(SKINIT,              "skinit",              0x80000001, 0, ECX, 12, 0,                 0)                                   \
+        X(WDT,                 "wdt",                 0x80000001, 0, ECX, 13, 0,                 0)                                   \
+        X(LWP,                 "lwp",                 0x80000001, 0, ECX, 15, 0,                 __LWP__)                             \
+        X(FMA4,                "fma4",                0x80000001, 0, ECX, 16, CPUID_XCR0_AVX,    __FMA4__)                            \
+        X(TCE,                 "tce",                 0x80000001, 0, ECX, 17, 0,                 0)                                   \
+        X(NODEID_MSR,          "nodeid_msr",          0x80000001, 0, ECX, 19, 0,                 0)                                   \
+        X(TBM,                 "tbm",                 0x80000001, 0, ECX, 21, 0,                 __TBM__)                             \
+        X(TOPOEXT,             "topoext",             0x80000001, 0, ECX, 22, 0,                 0)                                   \
+        X(PERFCTR_CORE,        "perfctr_core",        0x80000001, 0, ECX, 23, 0,                 0)                                   \
+        X(PERFCTR_NB,          "perfctr_nb",          0x80000001, 0, ECX, 24, 0,                 0)                                   \
+        X(DBX,                 "dbx",                 0x80000001, 0, ECX, 26, 0,                 0)                                   \
+        X(PERFTSC,             "perftsc",             0x80000001, 0, ECX, 27, 0,                 0)                                   \
+        X(PERFCTR_LLC,         "perfctr_llc",         0x80000001, 0, ECX, 28, 0,                 0)                                   \
+        X(MWAITX,              "mwaitx",              0x80000001, 0, ECX, 29, 0,                 __MWAITX__)                          \
+        /* 0x80000001.0 EDX */                                                                                                        \
+        X(SYSCALL,             "syscall",             0x80000001, 0, EDX, 11, 0,                 __x86_64__)                          \
+        X(NX,                  "nx",                  0x80000001, 0, EDX, 20, 0,                 0)                                   \
+        X(MMXEXT,              "mmxext",              0x80000001, 0, EDX, 22, 0,                 0)                                   \
+        X(FXSR_OPT,            "fxsr_opt",            0x80000001, 0, EDX, 25, 0,                 0)                                   \
+        X(PDPE1GB,             "pdpe1gb",             0x80000001, 0, EDX, 26, 0,                 0)                                   \
+        X(RDTSCP,              "rdtscp",              0x80000001, 0, EDX, 27, 0,                 0)                                   \
+        X(LM,                  "lm",                  0x80000001, 0, EDX, 29, 0,                 __x86_64__)                          \
+        X(3DNOWEXT,            "3dnowext",            0x80000001, 0, EDX, 30, 0,                 __3dNOW_A__)                         \
+        X(3DNOW,               "3dnow",               0x80000001, 0, EDX, 31, 0,                 __3dNOW__)                           \
+        /* 0x80000007.0 EDX */                                                                                                        \
+        X(INVTSC,              "invtsc",              0x80000007, 0, EDX,  8, 0,                 0)                                   \
+        /* 0x00000007.0 ECX */                                                                                                        \
+        X(WAITPKG,             "waitpkg",             0x00000007, 0, ECX,  5, 0,                 __WAITPKG__)                         \
+        X(CLDEMOTE,            "cldemote",            0x00000007, 0, ECX, 25, 0,                 __CLDEMOTE__)                        \
+        X(ENQCMD,              "enqcmd",              0x00000007, 0, ECX, 29, 0,                 __ENQCMD__)                          \
+        /* 0x00000007.0 EDX */                                                                                                        \
+        X(FSRM,                "fsrm",                0x00000007, 0, EDX,  4, 0,                 0)                                   \
+        X(SERIALIZE,           "serialize",           0x00000007, 0, EDX, 14, 0,                 __SERIALIZE__)                       \
+        /* 0x00000007.1 EAX */                                                                                                        \
+        X(FZRM,                "fzrm",                0x00000007, 1, EAX, 10, 0,                 0)                                   \
+        X(FSRS,                "fsrs",                0x00000007, 1, EAX, 11, 0,                 0)                                   \
+        X(FSRC,                "fsrc",                0x00000007, 1, EAX, 12, 0,                 0)                                   \
+        /* terminator */
+
+enum cpuid_feature_e {
+#define CPUID_FEATURE_ENUM(_id, ...)    CPUID_FEATURE_##_id,
+        CPUID_FEATURE_LIST(CPUID_FEATURE_ENUM)
+#undef CPUID_FEATURE_ENUM
+
+        CPUID_FEATURE_NB,
+};
+
+/*
+ * CPUID_DEFINED(__SSE2__): 1 if the macro is defined to 1,
+ * as the compiler ISA macros are, 0 otherwise or for a plain 0
+ */
+#define CPUID_DEFINED_1                 0,
+#define CPUID_DEFINED_2ND(_a, _b, ...)  _b
+#define CPUID_DEFINED_(_arg)            CPUID_DEFINED_2ND(_arg 1, 0, 0)
+#define CPUID_DEFINED_V(_v)             CPUID_DEFINED_(CPUID_DEFINED_##_v)
+#define CPUID_DEFINED(_macro)           CPUID_DEFINED_V(_macro)
+
+/* several returns in a constexpr function need C++14 */
+#if defined(__cplusplus) && __cplusplus >= 201402L
+# define CPUID_CONSTEXPR        constexpr
+#else
+# define CPUID_CONSTEXPR
+#endif
+
+/*
+ * 1 if the compiler target (-march, -m<isa>) already assumes id,
+ * from the macro column of CPUID_FEATURE_LIST().
+ * a constant expression, usable in C++14 if constexpr.
+ */
+static inline CPUID_CONSTEXPR int
+cpuid_feature_static(enum cpuid_feature_e id)
+{
+        switch (id) {
+#define CPUID_FEATURE_STATIC(_id, _name, _leaf, _sub_leaf, _reg, _bit,  \
+                             _xcr0, _macro)                             \
+        case CPUID_FEATURE_##_id:                                       \
+                return CPUID_DEFINED(_macro);
+        CPUID_FEATURE_LIST(CPUID_FEATURE_STATIC)
+#undef CPUID_FEATURE_STATIC
+        default:
+                return 0;
+        }
+}
+
+/*
+ * folds to 1 when the target implies id, the snapshot otherwise
+ */
+#define CPUID_HAS(_id)                                                  \
+        (cpuid_feature_static(CPUID_FEATURE_##_id) ||                   \
+         cpuid_feature_test(CPUID_FEATURE_##_id) > 0)
+
+#endif /* !_CPUID_FEATURE_H_ */
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_HV		0x40000000U
+#define CPUID_LEAF_HV_TIMING	0x40000010U
+#define CPUID_LEAF_XEN_VERSION	0x40000001U
+#define CPUID_LEAF_HYPERV_VERSION	0x40000002U
+
+static const struct {
+        const char *sig;	/* 0x40000000 EBX:ECX:EDX */
+        enum cpuid_hv_e kind;
+} cpuid_hv_sig[] = {
+        { "KVMKVMKVM\0\0\0", CPUID_HV_KVM, },
+        { "Microsoft Hv",    CPUID_HV_HYPERV, },
+        { "Linux KVM Hv",    CPUID_HV_HYPERV, },	/* KVM, Hyper-V ABI */
+        { "XenVMMXenVMM",    CPUID_HV_XEN, },
+        { "VMwareVMware",    CPUID_HV_VMWARE, },
+        { "TCGTCGTCGTCG",    CPUID_HV_TCG, },
+        { "bhyve bhyve ",    CPUID_HV_BHYVE, },
+        { "ACRNACRNACRN",    CPUID_HV_ACRN, },
+        { "VBoxVBoxVBox",    CPUID_HV_VBOX, },
+        { " lrpepyh  vr",    CPUID_HV_PARALLELS, },
+        { " QNXQVMBSQG ",    CPUID_HV_QNX, },
+
+        { NULL,              CPUID_HV_NONE, },	/* terminator */
+};
+
+static const char *cpuid_hv_names[CPUID_HV_NB] = {
+        [CPUID_HV_NONE]      = "none",
+        [CPUID_HV_OTHER]     = "other",
+        [CPUID_HV_KVM]       = "kvm",
+        [CPUID_HV_HYPERV]    = "hyperv",
+        [CPUID_HV_XEN]       = "xen",
+        [CPUID_HV_VMWARE]    = "vmware",
+        [CPUID_HV_TCG]       = "tcg",
+        [CPUID_HV_BHYVE]     = "bhyve",
+        [CPUID_HV_ACRN]      = "acrn",
+        [CPUID_HV_VBOX]      = "virtualbox",
+        [CPUID_HV_PARALLELS] = "parallels",
+        [CPUID_HV_QNX]       = "qnx",
+};
+
+/*
+ * paravirt bits, only meaningful for their own hypervisor
+ */
+struct cpuid_hv_flag {
+        const char *name;
+        enum cpuid_hv_e kind;
+        unsigned leaf;
+        unsigned reg;		/* 0: EAX .. 3: EDX */
+        unsigned bit;
+};
+
+static const struct cpuid_hv_flag cpuid_hv_flags[] = {
+        /* KVM: 0x40000001 EAX features, EDX hints */
+        { "kvmclock",          CPUID_HV_KVM,    0x40000001, 0, 0, },
+        { "nop_io_delay",      CPUID_HV_KVM,    0x40000001, 0, 1, },
+        { "kvmclock2",         CPUID_HV_KVM,    0x40000001, 0, 3, },
+        { "async_pf",          CPUID_HV_KVM,    0x40000001, 0, 4, },
+        { "steal_time",        CPUID_HV_KVM,    0x40000001, 0, 5, },
+        { "pv_eoi",            CPUID_HV_KVM,    0x40000001, 0, 6, },
+        { "pv_unhalt",         CPUID_HV_KVM,    0x40000001, 0, 7, },
+        { "pv_tlb_flush",      CPUID_HV_KVM,    0x40000001, 0, 9, },
+        { "async_pf_vmexit",   CPUID_HV_KVM,    0x40000001, 0, 10, },
+        { "pv_send_ipi",       CPUID_HV_KVM,    0x40000001, 0, 11, },
+        { "poll_control",      CPUID_HV_KVM,    0x40000001, 0, 12, },
+        { "pv_sched_yield",    CPUID_HV_KVM,    0x40000001, 0, 13, },
+        { "async_pf_int",      CPUID_HV_KVM,    0x40000001, 0, 14, },
+        { "msi_ext_dest_id",   CPUID_HV_KVM,    0x40000001, 0, 15, },
+        { "kvmclock_stable",   CPUID_HV_KVM,    0x40000001, 0, 24, },
+        { "realtime",          CPUID_HV_KVM,    0x40000001, 3, 0, },
+
+        /* Hyper-V: 0x40000003 EAX privileges, 0x40000004 EAX hints */
+        { "vp_runtime",        CPUID_HV_HYPERV, 0x40000003, 0, 0, },
+        { "time_ref_count",    CPUID_HV_HYPERV, 0x40000003, 0, 1, },
+        { "synic",             CPUID_HV_HYPERV, 0x40000003, 0, 2, },
+        { "stimer",            CPUID_HV_HYPERV, 0x40000003, 0, 3, },
+        { "apic_access",       CPUID_HV_HYPERV, 0x40000003, 0, 4, },
+        { "hypercall",         CPUID_HV_HYPERV, 0x40000003, 0, 5, },
+        { "vp_index",          CPUID_HV_HYPERV, 0x40000003, 0, 6, },
+        { "reset",             CPUID_HV_HYPERV, 0x40000003, 0, 7, },
+        { "reference_tsc",     CPUID_HV_HYPERV, 0x40000003, 0, 9, },
+        { "guest_idle",        CPUID_HV_HYPERV, 0x40000003, 0, 10, },
+        { "frequency_msrs",    CPUID_HV_HYPERV, 0x40000003, 0, 11, },
+        { "reenlightenment",   CPUID_HV_HYPERV, 0x40000003, 0, 13, },
+        { "as_switch",         CPUID_HV_HYPERV, 0x40000004, 0, 0, },
+        { "local_tlb_flush",   CPUID_HV_HYPERV, 0x40000004, 0, 1, },
+        { "remote_tlb_flush",  CPUID_HV_HYPERV, 0x40000004, 0, 2, },
+        { "apic_msrs",         CPUID_HV_HYPERV, 0x40000004, 0, 3, },
+        { "relaxed_timing",    CPUID_HV_HYPERV, 0x40000004, 0, 5, },
+        { "cluster_ipi",       CPUID_HV_HYPERV, 0x40000004, 0, 10, },
+        { "ex_processor_masks", CPUID_HV_HYPERV, 0x40000004, 0, 11, },
+        { "nested",            CPUID_HV_HYPERV, 0x40000004, 0, 12, },
+        { "enlightened_vmcs",  CPUID_HV_HYPERV, 0x40000004, 0, 14, },
+
+        { NULL,                CPUID_HV_NONE,   0,          0, 0, },	/* terminator */
+};
+
+static struct cpuid_hv cpuid_hv;
+static pthread_once_t cpuid_hv_once = PTHREAD_ONCE_INIT;
+
+static unsigned
+cpuid_hv_reg(unsigned leaf,
+             unsigned n)
+{
+        unsigned reg[4];
+
+        if (leaf > cpuid_hv.max_leaf || cpuid_leaf_read(leaf, 0, reg))
+                return 0;
+        return reg[n];
+}
+
+static void
+cpuid_hv_init(void)
+{
+        unsigned reg[4];
+
+        cpuid_hv.kind = CPUID_HV_NONE;
+        if (!cpuid_feature_test(cpuid_feature_id("hypervisor")))
+                return;
+
+        cpuid_hv.kind = CPUID_HV_OTHER;
+        if (cpuid_leaf_read(CPUID_LEAF_HV, 0, reg))
+                return;
+
+        memcpy(&cpuid_hv.vendor[0], &reg[1], 4);
+        memcpy(&cpuid_hv.vendor[4], &reg[2], 4);
+        memcpy(&cpuid_hv.vendor[8], &reg[3], 4);
+        cpuid_hv.vendor[12] = '\0';
+
+        /* old KVM reports 0 */
+        cpuid_hv.max_leaf = reg[0] < CPUID_LEAF_HV ?
+                            CPUID_LEAF_HV | 0x01 : reg[0];
+
+        for (unsigned i = 0; cpuid_hv_sig[i].sig; i++) {
+                if (!memcmp(cpuid_hv.vendor, cpuid_hv_sig[i].sig, 12)) {
+                        cpuid_hv.kind = cpuid_hv_sig[i].kind;
+                        break;
+                }
+        }
+
+        switch (cpuid_hv.kind) {
+        case CPUID_HV_HYPERV:
+                /* 0xFFFFFFFF: never notify, spin */
+                cpuid_hv.spin_retries = cpuid_hv_reg(0x40000004, 1);
+                /* 0x40000001 only holds the "Hv#1" interface id */
+                cpuid_hv.build = cpuid_hv_reg(CPUID_LEAF_HYPERV_VERSION, 0);
+                cpuid_hv.version = cpuid_hv_reg(CPUID_LEAF_HYPERV_VERSION, 1);
+                break;
+        case CPUID_HV_XEN:
+                cpuid_hv.version = cpuid_hv_reg(CPUID_LEAF_XEN_VERSION, 0);
+                break;
+        default:
+                break;
+        }
+
+        /* VMware style timing leaf, also set by KVM and others */
+        if (cpuid_hv.max_leaf >= CPUID_LEAF_HV_TIMING)
+                cpuid_hv.tsc_khz = cpuid_hv_reg(CPUID_LEAF_HV_TIMING,
+                                                0);
+}
+
+/*
+ * hypervisor the process runs under, from the snapshot.
+ * kind is CPUID_HV_NONE on bare metal.
+ */
+const struct cpuid_hv *
+cpuid_hv_read(void)
+{
+        pthread_once(&cpuid_hv_once, cpuid_hv_init);
+        return &cpuid_hv;
+}
+
+const char *
+cpuid_hv_name(enum cpuid_hv_e kind)
+{
+        if ((unsigned) kind >= CPUID_HV_NB)
+                return NULL;
+        return cpuid_hv_names[kind];
+}
+
+/*
+ * 1 if the paravirt flag is offered by the running hypervisor,
+ * 0 if not, -1 if unknown
+ */
+int
+cpuid_hv_flag_test(const char *name)
+{
+        const struct cpuid_hv *hv = cpuid_hv_read();
+
+        for (unsigned i = 0; cpuid_hv_flags[i].name; i++) {
+                const struct cpuid_hv_flag *f = &cpuid_hv_flags[i];
+
+                if (strcmp(name, f->name))
+                        continue;
+                if (f->kind != hv->kind)
+                        return 0;
+                return (cpuid_hv_reg(f->leaf, f->reg) >> f->bit) & 1;
+        }
+        return -1;
+}
+
+/*
+ * i-th paravirt flag name, NULL past the end
+ */
+const char *
+cpuid_hv_flag_name(unsigned i)
+{
+        if (i >= ARRAYOF(cpuid_hv_flags))
+                return NULL;
+        return cpuid_hv_flags[i].name;
+}
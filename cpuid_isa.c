@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "cpuid.h"
+
+struct cpuid_isa_attr {
+        const char *name;
+        const char **features;	/* added to the level below */
+        uint64_t xcr0;
+};
+
+static const char *cpuid_isa_v1[] = {
+        "cmov", "cx8", "fpu", "fxsr", "mmx", "sse", "sse2", "syscall", "lm",
+
+        NULL,	/* terminator */
+};
+
+static const char *cpuid_isa_v2[] = {
+        "cx16", "lahf_lm", "popcnt", "sse3", "sse4.1", "sse4.2", "ssse3",
+
+        NULL,	/* terminator */
+};
+
+static const char *cpuid_isa_v3[] = {
+        "avx", "avx2", "bmi1", "bmi2", "f16c", "fma", "lzcnt", "movbe",
+        "xsave", "osxsave",
+
+        NULL,	/* terminator */
+};
+
+static const char *cpuid_isa_v4[] = {
+        "avx512f", "avx512bw", "avx512cd", "avx512dq", "avx512vl",
+
+        NULL,	/* terminator */
+};
+
+static const struct cpuid_isa_attr cpuid_isa_attr[CPUID_ISA_NB] = {
+        [CPUID_ISA_NONE] = {
+                .name     = "none",
+        },
+        [CPUID_ISA_V1] = {
+                .name     = "x86-64",
+                .features = cpuid_isa_v1,
+        },
+        [CPUID_ISA_V2] = {
+                .name     = "x86-64-v2",
+                .features = cpuid_isa_v2,
+        },
+        [CPUID_ISA_V3] = {
+                .name     = "x86-64-v3",
+                .features = cpuid_isa_v3,
+                .xcr0     = CPUID_XCR0_AVX,
+        },
+        [CPUID_ISA_V4] = {
+                .name     = "x86-64-v4",
+                .features = cpuid_isa_v4,
+                .xcr0     = CPUID_XCR0_AVX512,
+        },
+};
+
+/* cumulative requirements of each level */
+static struct cpuid_features cpuid_isa_want[CPUID_ISA_NB];
+static pthread_once_t cpuid_isa_once = PTHREAD_ONCE_INIT;
+
+static void
+cpuid_isa_init(void)
+{
+        cpuid_features_zero(&cpuid_isa_want[CPUID_ISA_NONE]);
+
+        for (unsigned level = CPUID_ISA_V1; level < CPUID_ISA_NB; level++) {
+                struct cpuid_features set;
+
+                cpuid_features_from_names(&set, cpuid_isa_attr[level].features);
+                cpuid_features_or(&cpuid_isa_want[level],
+                                  &cpuid_isa_want[level - 1], &set);
+        }
+}
+
+const char *
+cpuid_isa_name(enum cpuid_isa_level_e level)
+{
+        if (level >= CPUID_ISA_NB)
+                return NULL;
+        return cpuid_isa_attr[level].name;
+}
+
+/*
+ * features required by level, including the levels below
+ */
+int
+cpuid_isa_features(enum cpuid_isa_level_e level,
+                   struct cpuid_features *set)
+{
+        if (level >= CPUID_ISA_NB)
+                return -1;
+
+        pthread_once(&cpuid_isa_once, cpuid_isa_init);
+        *set = cpuid_isa_want[level];
+        return 0;
+}
+
+/*
+ * highest level usable on this CPU and OS. missing, if not NULL,
+ * gets what the next level lacks, empty at the top level.
+ */
+enum cpuid_isa_level_e
+cpuid_isa_level(struct cpuid_features *missing)
+{
+        enum cpuid_isa_level_e level = CPUID_ISA_NONE;
+        struct cpuid_features have;
+        uint64_t xcr0 = cpuid_xcr0();
+
+        pthread_once(&cpuid_isa_once, cpuid_isa_init);
+        cpuid_features_read(&have);
+
+        while (level + 1 < CPUID_ISA_NB) {
+                enum cpuid_isa_level_e next = level + 1;
+
+                if (!cpuid_features_has_all(&have, &cpuid_isa_want[next]) ||
+                    (xcr0 & cpuid_isa_attr[next].xcr0) != cpuid_isa_attr[next].xcr0)
+                        break;
+                level = next;
+        }
+
+        if (missing) {
+                if (level + 1 < CPUID_ISA_NB)
+                        cpuid_features_andnot(missing,
+                                              &cpuid_isa_want[level + 1],
+                                              &have);
+                else
+                        cpuid_features_zero(missing);
+        }
+        return level;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+static const struct {
+        enum cpuid_feature_e id;
+        unsigned flag;
+} cpuid_mem_attr[] = {
+        { CPUID_FEATURE_CLFSH,      CPUID_MEM_F_CLFLUSH, },
+        { CPUID_FEATURE_CLFLUSHOPT, CPUID_MEM_F_CLFLUSHOPT, },
+        { CPUID_FEATURE_CLWB,       CPUID_MEM_F_CLWB, },
+        { CPUID_FEATURE_CLDEMOTE,   CPUID_MEM_F_CLDEMOTE, },
+        { CPUID_FEATURE_SSE2,       CPUID_MEM_F_MOVNT, },
+        { CPUID_FEATURE_MOVDIRI,    CPUID_MEM_F_MOVDIRI, },
+        { CPUID_FEATURE_MOVDIR64B,  CPUID_MEM_F_MOVDIR64B, },
+        { CPUID_FEATURE_ENQCMD,     CPUID_MEM_F_ENQCMD, },
+        { CPUID_FEATURE_SERIALIZE,  CPUID_MEM_F_SERIALIZE, },
+        { CPUID_FEATURE_WAITPKG,    CPUID_MEM_F_WAITPKG, },
+        { CPUID_FEATURE_ERMS,       CPUID_MEM_F_ERMS, },
+        { CPUID_FEATURE_FSRM,       CPUID_MEM_F_FSRM, },
+        { CPUID_FEATURE_FZRM,       CPUID_MEM_F_FZRM, },
+        { CPUID_FEATURE_FSRS,       CPUID_MEM_F_FSRS, },
+        { CPUID_FEATURE_FSRC,       CPUID_MEM_F_FSRC, },
+};
+
+/*
+ * flush, store and wait primitives of this CPU in one place
+ */
+void
+cpuid_mem_read(struct cpuid_mem *mem)
+{
+        unsigned reg[4];
+
+        memset(mem, 0, sizeof(*mem));
+        for (unsigned i = 0; i < ARRAYOF(cpuid_mem_attr); i++) {
+                if (cpuid_feature_test(cpuid_mem_attr[i].id) > 0)
+                        mem->flags |= cpuid_mem_attr[i].flag;
+        }
+
+        if ((mem->flags & CPUID_MEM_F_CLFLUSH) && !cpuid_leaf_read(1, 0, reg))
+                mem->clflush_size = ((reg[1] >> 8) & 0xff) * 8;
+
+        /* write back and keep the line, then evict without order, then ordered */
+        if (mem->flags & CPUID_MEM_F_CLWB)
+                mem->flush = CPUID_FLUSH_CLWB;
+        else if (mem->flags & CPUID_MEM_F_CLFLUSHOPT)
+                mem->flush = CPUID_FLUSH_CLFLUSHOPT;
+        else if (mem->flags & CPUID_MEM_F_CLFLUSH)
+                mem->flush = CPUID_FLUSH_CLFLUSH;
+        else
+                mem->flush = CPUID_FLUSH_NONE;
+}
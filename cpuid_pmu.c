@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_PMU		0x0000000aU
+#define CPUID_LEAF_PMU_EXT	0x00000023U
+#define CPUID_LEAF_PMU_AMD	0x80000022U
+
+static const char *cpuid_pmu_names[CPUID_PMU_EV_NB] = {
+        [CPUID_PMU_EV_CYCLES]        = "cycles",
+        [CPUID_PMU_EV_INSTRUCTIONS]  = "instructions",
+        [CPUID_PMU_EV_REF_CYCLES]    = "ref-cycles",
+        [CPUID_PMU_EV_LLC_REFS]      = "llc-references",
+        [CPUID_PMU_EV_LLC_MISSES]    = "llc-misses",
+        [CPUID_PMU_EV_BRANCHES]      = "branches",
+        [CPUID_PMU_EV_BRANCH_MISSES] = "branch-misses",
+};
+
+/* architectural event i is the generic perf event */
+static const unsigned long long cpuid_pmu_perf[CPUID_PMU_EV_NB] = {
+        [CPUID_PMU_EV_CYCLES]        = PERF_COUNT_HW_CPU_CYCLES,
+        [CPUID_PMU_EV_INSTRUCTIONS]  = PERF_COUNT_HW_INSTRUCTIONS,
+        [CPUID_PMU_EV_REF_CYCLES]    = PERF_COUNT_HW_REF_CPU_CYCLES,
+        [CPUID_PMU_EV_LLC_REFS]      = PERF_COUNT_HW_CACHE_REFERENCES,
+        [CPUID_PMU_EV_LLC_MISSES]    = PERF_COUNT_HW_CACHE_MISSES,
+        [CPUID_PMU_EV_BRANCHES]      = PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+        [CPUID_PMU_EV_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/*
+ * counters of the architectural PMU, leaf 0xA with the leaf 0x23
+ * bitmaps on newer parts, AMD core counters from 0x80000022.
+ * -1 if the CPU, or the hypervisor, exposes none.
+ */
+int
+cpuid_pmu_read(struct cpuid_pmu *pmu)
+{
+        unsigned reg[4];
+
+        memset(pmu, 0, sizeof(*pmu));
+        if (!cpuid_leaf_read(CPUID_LEAF_PMU, 0, reg) && (reg[0] & 0xff)) {
+                unsigned len = reg[0] >> 24;
+
+                pmu->version = reg[0] & 0xff;
+                pmu->gp = (reg[0] >> 8) & 0xff;
+                pmu->gp_width = (reg[0] >> 16) & 0xff;
+                /* EBX bits set for events that are NOT available */
+                for (unsigned ev = 0; ev < CPUID_PMU_EV_NB && ev < len; ev++) {
+                        if (!(reg[1] & (1u << ev)))
+                                pmu->events |= 1u << ev;
+                }
+                if (pmu->version >= 2) {
+                        pmu->fixed = reg[3] & 0x1f;
+                        pmu->fixed_width = (reg[3] >> 5) & 0xff;
+                }
+                pmu->gp_mask = pmu->gp < 32 ? (1u << pmu->gp) - 1 : ~0u;
+                pmu->fixed_mask = (1u << pmu->fixed) - 1;
+                if (pmu->version >= 5)
+                        pmu->fixed_mask |= reg[2];
+
+                /* sub-leaf 1: counter bitmaps, may have holes */
+                if (!cpuid_leaf_read(CPUID_LEAF_PMU_EXT, 0, reg) &&
+                    (reg[0] & (1u << 1)) &&
+                    !cpuid_leaf_read(CPUID_LEAF_PMU_EXT, 1, reg)) {
+                        pmu->gp_mask = reg[0];
+                        pmu->fixed_mask = reg[1];
+                        pmu->gp = (unsigned) __builtin_popcount(reg[0]);
+                        pmu->fixed = (unsigned) __builtin_popcount(reg[1]);
+                }
+                return 0;
+        }
+
+        if (!cpuid_leaf_read(CPUID_LEAF_PMU_AMD, 0, reg) && (reg[1] & 0xf)) {
+                pmu->gp = reg[1] & 0xf;
+                pmu->gp_width = 48;
+                pmu->gp_mask = (1u << pmu->gp) - 1;
+                pmu->events = (1u << CPUID_PMU_EV_CYCLES) |
+                              (1u << CPUID_PMU_EV_INSTRUCTIONS) |
+                              (1u << CPUID_PMU_EV_BRANCHES) |
+                              (1u << CPUID_PMU_EV_BRANCH_MISSES);
+                return 0;
+        }
+        return -1;
+}
+
+const char *
+cpuid_pmu_event_name(enum cpuid_pmu_event_e ev)
+{
+        if ((unsigned) ev >= CPUID_PMU_EV_NB)
+                return NULL;
+        return cpuid_pmu_names[ev];
+}
+
+static int
+cpuid_perf_event(unsigned long long config)
+{
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.pinned = 1;	/* no multiplexing, rdpmc stays valid */
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * count the events of mask (1 << CPUID_PMU_EV_*) in the calling
+ * thread. events the PMU lacks are dropped, so are those beyond
+ * its counters. 0 if at least one event is counted.
+ */
+int
+cpuid_perf_open(struct cpuid_perf *perf,
+                unsigned mask)
+{
+        struct cpuid_pmu pmu;
+        unsigned room;
+        long page = sysconf(_SC_PAGESIZE);
+
+        memset(perf, 0, sizeof(*perf));
+        if (cpuid_pmu_read(&pmu))
+                return -1;
+
+        mask &= pmu.events;
+        room = pmu.gp + pmu.fixed;
+        for (unsigned ev = 0; ev < CPUID_PMU_EV_NB && perf->nb < room; ev++) {
+                struct cpuid_perf_counter *cnt = &perf->cnt[perf->nb];
+                const struct perf_event_mmap_page *pc;
+                void *p;
+
+                if (!(mask & (1u << ev)))
+                        continue;
+
+                cnt->fd = cpuid_perf_event(cpuid_pmu_perf[ev]);
+                if (cnt->fd < 0)
+                        continue;
+                p = mmap(NULL, (size_t) page, PROT_READ, MAP_SHARED,
+                         cnt->fd, 0);
+                if (p == MAP_FAILED) {
+                        close(cnt->fd);
+                        continue;
+                }
+
+                pc = p;
+                cnt->page = p;
+                cnt->event = (enum cpuid_pmu_event_e) ev;
+                /* else read(2), microseconds */
+                cnt->rdpmc = pc->cap_user_rdpmc && pc->pmc_width;
+                perf->rdpmc += (unsigned) cnt->rdpmc;
+                perf->nb++;
+        }
+        return perf->nb ? 0 : -1;
+}
+
+void
+cpuid_perf_close(struct cpuid_perf *perf)
+{
+        long page = sysconf(_SC_PAGESIZE);
+
+        for (unsigned i = 0; i < perf->nb; i++) {
+                munmap(perf->cnt[i].page, (size_t) page);
+                close(perf->cnt[i].fd);
+        }
+        perf->nb = 0;
+}
+
+static inline uint64_t
+cpuid_rdpmc(unsigned idx)
+{
+        unsigned lo, hi;
+
+        __asm__ __volatile__ ("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx));
+        return ((uint64_t) hi << 32) | lo;
+}
+
+/*
+ * user page protocol of perf_event_mmap_page,
+ * -1 if the page no longer allows rdpmc
+ */
+static int
+cpuid_perf_counter(const struct cpuid_perf_counter *cnt,
+                   uint64_t *count)
+{
+        const volatile struct perf_event_mmap_page *pc = cnt->page;
+        unsigned seq;
+
+        do {
+                seq = pc->lock;
+                __asm__ __volatile__ ("" ::: "memory");
+                *count = (uint64_t) pc->offset;
+                if (pc->index) {
+                        unsigned width = pc->pmc_width;
+                        unsigned shift = 64u - width;
+                        int64_t pmc;
+
+                        if (!width || width > 64)
+                                return -1;
+                        pmc = (int64_t) (cpuid_rdpmc(pc->index - 1) << shift);
+                        *count += (uint64_t) (pmc >> shift);
+                }
+                __asm__ __volatile__ ("" ::: "memory");
+        } while (pc->lock != seq);
+        return 0;
+}
+
+/*
+ * current counts, in the order the events were opened
+ */
+void
+cpuid_perf_read(const struct cpuid_perf *perf,
+                uint64_t *counts)
+{
+        for (unsigned i = 0; i < perf->nb; i++) {
+                const struct cpuid_perf_counter *cnt = &perf->cnt[i];
+
+                if (cnt->rdpmc && !cpuid_perf_counter(cnt, &counts[i]))
+                        continue;
+                if (read(cnt->fd, &counts[i], sizeof(counts[i])) !=
+                    (ssize_t) sizeof(counts[i]))
+                        counts[i] = 0;
+        }
+}
+
+void
+cpuid_perf_begin(const struct cpuid_perf *perf,
+                 struct cpuid_perf_region *region)
+{
+        cpuid_perf_read(perf, region->start);
+}
+
+/*
+ * accumulate the counts since cpuid_perf_begin() of region
+ */
+void
+cpuid_perf_end(const struct cpuid_perf *perf,
+               struct cpuid_perf_region *region)
+{
+        uint64_t now[CPUID_PERF_MAX];
+
+        cpuid_perf_read(perf, now);
+        for (unsigned i = 0; i < perf->nb; i++)
+                region->sum[i] += now[i] - region->start[i];
+        region->calls++;
+}
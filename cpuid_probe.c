@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "cpuid.h"
+
+#define CPUID_PROBE_ITER	(1u << 18)	/* per kernel run, 8 ops each */
+#define CPUID_PROBE_CHAIN	(1u << 14)	/* dependent adds, x 64 */
+#define CPUID_PROBE_RUNS	5
+
+/* a wider width has to win by this much to be preferred */
+#define CPUID_PROBE_GAIN	1.15
+#define CPUID_PROBE_CLOCK	0.90
+
+static volatile double cpuid_probe_sink;
+
+/*
+ * core clock relative to the TSC: a chain of dependent adds
+ * retires one per core cycle. register operand, since newer
+ * cores fold add-immediate chains at rename.
+ */
+static double
+cpuid_probe_clock(void)
+{
+        uint64_t t, v = 0, one = 1;
+
+        t = cpuid_rdtsc();
+        for (unsigned i = 0; i < CPUID_PROBE_CHAIN; i++) {
+                __asm__ __volatile__ (".rept 64\n\t"
+                                      "add %1, %0\n\t"
+                                      ".endr\n\t"
+                                      : "+r" (v) : "r" (one));
+        }
+        t = cpuid_rdtsc() - t;
+        return (double) v / (double) t;
+}
+
+/*
+ * 8 independent accumulators, 8 vector ops per iteration
+ */
+static uint64_t
+cpuid_probe_sse(void)
+{
+        __m128d acc[8], m = _mm_set1_pd(0.999999), a = _mm_set1_pd(1e-9);
+        uint64_t t;
+
+        for (unsigned i = 0; i < 8; i++)
+                acc[i] = _mm_set1_pd((double) i);
+
+        t = cpuid_rdtsc();
+        for (unsigned n = 0; n < CPUID_PROBE_ITER; n++) {
+                for (unsigned i = 0; i < 8; i++)
+                        acc[i] = _mm_add_pd(_mm_mul_pd(acc[i], m), a);
+                __asm__ __volatile__ ("" : "+x" (acc[0]), "+x" (acc[7]));
+        }
+        t = cpuid_rdtsc() - t;
+
+        for (unsigned i = 1; i < 8; i++)
+                acc[0] = _mm_add_pd(acc[0], acc[i]);
+        cpuid_probe_sink = _mm_cvtsd_f64(acc[0]);
+        return t;
+}
+
+__attribute__((target("avx2,fma")))
+static uint64_t
+cpuid_probe_avx2(void)
+{
+        __m256d acc[8], m = _mm256_set1_pd(0.999999), a = _mm256_set1_pd(1e-9);
+        uint64_t t;
+
+        for (unsigned i = 0; i < 8; i++)
+                acc[i] = _mm256_set1_pd((double) i);
+
+        t = cpuid_rdtsc();
+        for (unsigned n = 0; n < CPUID_PROBE_ITER; n++) {
+                for (unsigned i = 0; i < 8; i++)
+                        acc[i] = _mm256_fmadd_pd(acc[i], m, a);
+                __asm__ __volatile__ ("" : "+x" (acc[0]), "+x" (acc[7]));
+        }
+        t = cpuid_rdtsc() - t;
+
+        for (unsigned i = 1; i < 8; i++)
+                acc[0] = _mm256_add_pd(acc[0], acc[i]);
+        cpuid_probe_sink = _mm256_cvtsd_f64(acc[0]);
+        _mm256_zeroupper();
+        return t;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t
+cpuid_probe_avx512(void)
+{
+        __m512d acc[8], m = _mm512_set1_pd(0.999999), a = _mm512_set1_pd(1e-9);
+        uint64_t t;
+
+        for (unsigned i = 0; i < 8; i++)
+                acc[i] = _mm512_set1_pd((double) i);
+
+        t = cpuid_rdtsc();
+        for (unsigned n = 0; n < CPUID_PROBE_ITER; n++) {
+                for (unsigned i = 0; i < 8; i++)
+                        acc[i] = _mm512_fmadd_pd(acc[i], m, a);
+                __asm__ __volatile__ ("" : "+v" (acc[0]), "+v" (acc[7]));
+        }
+        t = cpuid_rdtsc() - t;
+
+        for (unsigned i = 1; i < 8; i++)
+                acc[0] = _mm512_add_pd(acc[0], acc[i]);
+        cpuid_probe_sink = _mm512_reduce_add_pd(acc[0]);
+        _mm256_zeroupper();
+        return t;
+}
+
+static const char *cpuid_probe_128[] = {
+        "sse2",
+        NULL,	/* terminator */
+};
+
+static const char *cpuid_probe_256[] = {
+        "avx", "avx2", "fma",
+        NULL,	/* terminator */
+};
+
+static const char *cpuid_probe_512[] = {
+        "avx512f",
+        NULL,	/* terminator */
+};
+
+static const struct {
+        const char **features;
+        unsigned lanes;		/* doubles per vector */
+        uint64_t (*kernel)(void);
+} cpuid_probe_attr[CPUID_VEC_NB] = {
+        [CPUID_VEC_128] = { cpuid_probe_128, 2, cpuid_probe_sse, },
+        [CPUID_VEC_256] = { cpuid_probe_256, 4, cpuid_probe_avx2, },
+        [CPUID_VEC_512] = { cpuid_probe_512, 8, cpuid_probe_avx512, },
+};
+
+/*
+ * best of CPUID_PROBE_RUNS after a warm-up run, so that a frequency
+ * license is already in effect; the clock is sampled right after
+ */
+static void
+cpuid_probe_width(enum cpuid_vec_width_e width,
+                  struct cpuid_vec_probe *res)
+{
+        uint64_t best = UINT64_MAX;
+        double ops;		/* mul+add and fma count as 2 */
+
+        cpuid_probe_attr[width].kernel();
+        for (unsigned r = 0; r < CPUID_PROBE_RUNS; r++) {
+                uint64_t t = cpuid_probe_attr[width].kernel();
+
+                if (t < best)
+                        best = t;
+        }
+        res->clock = cpuid_probe_clock();
+
+        ops = (double) CPUID_PROBE_ITER * 8.0 * cpuid_probe_attr[width].lanes;
+        res->flops = ops * 2.0 / (double) best;
+}
+
+/*
+ * run the kernels of every usable vector width and fill probe.
+ * the kernels execute here, so a replayed backend is refused.
+ * takes a few tens of milliseconds.
+ */
+int
+cpuid_probe_simd(struct cpuid_simd_probe *probe)
+{
+        struct cpuid_features have;
+
+        memset(probe, 0, sizeof(*probe));
+        if (cpuid_backend_get() != &cpuid_backend_live)
+                return -1;
+        cpuid_features_read(&have);
+        probe->base_clock = cpuid_probe_clock();
+        probe->preferred = CPUID_VEC_128;
+
+        for (unsigned w = 0; w < CPUID_VEC_NB; w++) {
+                struct cpuid_features want;
+                const struct cpuid_vec_probe *best;
+                struct cpuid_vec_probe *res = &probe->width[w];
+
+                cpuid_features_from_names(&want, cpuid_probe_attr[w].features);
+                if (!cpuid_features_has_all(&have, &want))
+                        continue;
+
+                cpuid_probe_width((enum cpuid_vec_width_e) w, res);
+                res->usable = 1;
+
+                /* wider only if faster and not costing the clock */
+                best = &probe->width[probe->preferred];
+                if (res->flops >= best->flops * CPUID_PROBE_GAIN &&
+                    res->clock >= probe->base_clock * CPUID_PROBE_CLOCK)
+                        probe->preferred = (enum cpuid_vec_width_e) w;
+        }
+        return 0;
+}
+
+/*
+ * drop the features of every width above the preferred one from set,
+ * before handing it to cpuid_impl_select()
+ */
+void
+cpuid_probe_mask(const struct cpuid_simd_probe *probe,
+                 struct cpuid_features *set)
+{
+        const char *name;
+
+        for (unsigned w = probe->preferred + 1; w < CPUID_VEC_NB; w++) {
+                const char **features = cpuid_probe_attr[w].features;
+
+                for (unsigned n = 0; features[n]; n++)
+                        cpuid_features_clear(set, cpuid_feature_id(features[n]));
+        }
+        if (probe->preferred >= CPUID_VEC_512)
+                return;
+
+        /* and every extension built on avx512f */
+        for (int id = 0; (name = cpuid_feature_name(id)) != NULL; id++) {
+                if (!strncmp(name, "avx512", 6) || !strncmp(name, "avx10", 5))
+                        cpuid_features_clear(set, id);
+        }
+}
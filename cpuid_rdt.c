@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_RDT_MON	0x0000000fU
+#define CPUID_LEAF_RDT_ALLOC	0x00000010U
+#define CPUID_LEAF_RDT_AMD	0x80000020U
+
+/*
+ * L3 or L2 cache allocation, leaf 0x10 sub-leaf 1 or 2
+ */
+static void
+cpuid_rdt_cat(struct cpuid_rdt_cat *cat,
+              unsigned sub_leaf)
+{
+        unsigned reg[4];
+
+        if (cpuid_leaf_read(CPUID_LEAF_RDT_ALLOC, sub_leaf, reg))
+                return;
+
+        cat->cbm_len = (reg[0] & 0x1f) + 1;
+        cat->shareable = reg[1];
+        cat->cdp = (reg[2] >> 2) & 0x1;
+        cat->noncontig = (reg[2] >> 3) & 0x1;
+        cat->clos = (reg[3] & 0xffff) + 1;
+}
+
+/*
+ * Resource Director Technology: monitoring from leaf 0xF,
+ * allocation from leaf 0x10, AMD bandwidth from 0x80000020.
+ * zero counts for what the CPU lacks. -1 without pqm and pq.
+ */
+int
+cpuid_rdt_read(struct cpuid_rdt *rdt)
+{
+        unsigned reg[4];
+        int pqm = cpuid_feature_test(cpuid_feature_id("pqm"));
+        int pq = cpuid_feature_test(cpuid_feature_id("pq"));
+
+        memset(rdt, 0, sizeof(*rdt));
+        if (pqm <= 0 && pq <= 0)
+                return -1;
+
+        if (pqm > 0 && !cpuid_leaf_read(CPUID_LEAF_RDT_MON, 0, reg) &&
+            (reg[3] & (1u << 1)) &&
+            !cpuid_leaf_read(CPUID_LEAF_RDT_MON, 1, reg)) {
+                rdt->mon.counter_width = 24 + (reg[0] & 0xff);
+                rdt->mon.overflow = (reg[0] >> 8) & 0x1;
+                rdt->mon.scale = reg[1];
+                rdt->mon.rmids = reg[2] + 1;
+                rdt->mon.occupancy = reg[3] & 0x1;
+                rdt->mon.mbm_total = (reg[3] >> 1) & 0x1;
+                rdt->mon.mbm_local = (reg[3] >> 2) & 0x1;
+        }
+
+        if (pq > 0 && !cpuid_leaf_read(CPUID_LEAF_RDT_ALLOC, 0, reg)) {
+                unsigned res = reg[1];
+
+                if (res & (1u << 1))
+                        cpuid_rdt_cat(&rdt->l3, 1);
+                if (res & (1u << 2))
+                        cpuid_rdt_cat(&rdt->l2, 2);
+                if ((res & (1u << 3)) &&
+                    !cpuid_leaf_read(CPUID_LEAF_RDT_ALLOC, 3, reg)) {
+                        rdt->mba.max_throttle = (reg[0] & 0xfff) + 1;
+                        rdt->mba.linear = (reg[2] >> 2) & 0x1;
+                        rdt->mba.clos = (reg[3] & 0xffff) + 1;
+                }
+        }
+
+        /* AMD: bandwidth limits in 1/8 GB/s units */
+        if (!cpuid_leaf_read(CPUID_LEAF_RDT_AMD, 0, reg) &&
+            (reg[1] & (1u << 1)) &&
+            !cpuid_leaf_read(CPUID_LEAF_RDT_AMD, 1, reg)) {
+                rdt->mba.bw_len = reg[0];
+                rdt->mba.clos = (reg[3] & 0xffff) + 1;
+        }
+        return 0;
+}
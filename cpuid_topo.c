@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_TOPO		0x0000000bU
+#define CPUID_LEAF_TOPO_V2	0x0000001fU
+#define CPUID_LEAF_HYBRID	0x0000001aU
+#define CPUID_LEVEL_MAX		8
+
+#define CPUID_LEVEL_SMT		1
+#define CPUID_LEVEL_CORE	2
+#define CPUID_LEVEL_MODULE	3
+#define CPUID_LEVEL_TILE	4
+
+#define CPUID_SCAN_STACK	(64 * 1024)
+
+struct cpuid_scan_arg {
+        pthread_t th;
+        struct cpuid_cpu *cpu;
+        unsigned l3_shift;
+        int ret;
+};
+
+static unsigned
+cpuid_order(unsigned nb)
+{
+        unsigned shift = 0;
+
+        while (nb > (1u << shift))
+                shift++;
+        return shift;
+}
+
+static unsigned
+cpuid_max_leaf(void)
+{
+        unsigned reg[4];
+
+        if (cpuid_leaf_read(0, 0, reg))
+                return 0;
+        return reg[0];
+}
+
+/*
+ * APIC ID bits above each level, from leaf 0x1F or 0xB
+ * on the calling CPU. returns -1 if neither is there.
+ */
+static int
+cpuid_topo_levels(struct cpuid_cpu *cpu,
+                  unsigned leaf)
+{
+        unsigned smt = 0, core = 0, module = 0;
+        unsigned shift = 0;
+        unsigned reg[4];
+
+        for (unsigned sub_leaf = 0; sub_leaf < CPUID_LEVEL_MAX; sub_leaf++) {
+                unsigned type;
+
+                if (cpuid_leaf_exec(leaf, sub_leaf, reg))
+                        break;
+                type = (reg[2] >> 8) & 0xff;
+                if (!type)
+                        break;
+                if (!sub_leaf)
+                        cpu->apic_id = reg[3];
+
+                shift = reg[0] & 0x1f;
+                switch (type) {
+                case CPUID_LEVEL_SMT:
+                        smt = shift;
+                        break;
+                case CPUID_LEVEL_CORE:
+                        core = shift;
+                        break;
+                case CPUID_LEVEL_MODULE:
+                case CPUID_LEVEL_TILE:
+                        module = shift;
+                        break;
+                default:	/* die and above: only the last shift */
+                        break;
+                }
+        }
+        if (!shift)
+                return -1;
+
+        /* missing levels collapse onto the one below */
+        if (!core)
+                core = smt;
+        if (module < core)
+                module = core;
+
+        cpu->core    = cpu->apic_id >> smt;
+        cpu->module  = cpu->apic_id >> core;
+        cpu->die     = cpu->apic_id >> module;
+        cpu->package = cpu->apic_id >> shift;
+        cpu->smt     = cpu->apic_id & ((1u << smt) - 1);
+        return 0;
+}
+
+/*
+ * without 0xB: initial APIC ID and the leaf 1/4 counts
+ */
+static void
+cpuid_topo_legacy(struct cpuid_cpu *cpu)
+{
+        unsigned reg[4];
+        unsigned logical, cores = 1;
+        unsigned pkg_shift, smt_shift;
+
+        cpuid_leaf_exec(1, 0, reg);
+        cpu->apic_id = reg[1] >> 24;
+        logical = (reg[1] >> 16) & 0xff;
+        if (!(reg[3] & (1u << 28)) || !logical)
+                logical = 1;
+        if (!cpuid_leaf_read(4, 0, reg) && (reg[0] & 0x1f))
+                cores = (reg[0] >> 26) + 1;
+
+        pkg_shift = cpuid_order(logical);
+        smt_shift = cpuid_order(logical / cores ? logical / cores : 1);
+
+        cpu->smt     = cpu->apic_id & ((1u << smt_shift) - 1);
+        cpu->core    = cpu->apic_id >> smt_shift;
+        cpu->module  = cpu->core;
+        cpu->package = cpu->apic_id >> pkg_shift;
+        cpu->die     = cpu->package;
+}
+
+static void *
+cpuid_scan_thread(void *p)
+{
+        struct cpuid_scan_arg *arg = p;
+        struct cpuid_cpu *cpu = arg->cpu;
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET((unsigned) cpu->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) ||
+            sched_getcpu() != cpu->cpu) {
+                arg->ret = -1;
+                return NULL;
+        }
+
+        if ((cpuid_max_leaf() < CPUID_LEAF_TOPO_V2 ||
+             cpuid_topo_levels(cpu, CPUID_LEAF_TOPO_V2)) &&
+            (cpuid_max_leaf() < CPUID_LEAF_TOPO ||
+             cpuid_topo_levels(cpu, CPUID_LEAF_TOPO)))
+                cpuid_topo_legacy(cpu);
+
+        cpu->l3 = cpu->apic_id >> arg->l3_shift;
+
+        if (cpuid_max_leaf() >= CPUID_LEAF_HYBRID) {
+                unsigned reg[4];
+
+                if (!cpuid_leaf_exec(CPUID_LEAF_HYBRID, 0, reg)) {
+                        cpu->core_type = (enum cpuid_core_type_e) (reg[0] >> 24);
+                        cpu->native_model = reg[0] & 0xffffff;
+                }
+        }
+        arg->ret = cpuid_features_exec(&cpu->features);
+        return NULL;
+}
+
+/*
+ * APIC ID bits shared by CPUs of one last level cache
+ */
+static unsigned
+cpuid_l3_shift(void)
+{
+        struct cpuid_cache caches[CPUID_CACHE_MAX];
+        unsigned nb = cpuid_cache_read(caches, CPUID_CACHE_MAX);
+        unsigned shared = 0;
+
+        for (unsigned i = 0; i < nb; i++) {
+                if (caches[i].type != CPUID_CACHE_INST)
+                        shared = caches[i].shared;	/* last level wins */
+        }
+        return shared ? cpuid_order(shared) : 0;
+}
+
+/*
+ * scan every CPU this process may run on, one pinned thread per CPU,
+ * all in parallel. NULL on failure.
+ */
+struct cpuid_topology *
+cpuid_topology_scan(void)
+{
+        struct cpuid_topology *topo = NULL;
+        struct cpuid_scan_arg *args = NULL;
+        pthread_attr_t attr;
+        cpu_set_t allowed;
+        unsigned nb, n = 0;
+        unsigned l3_shift;
+        int failed = 0;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+                return NULL;
+        nb = (unsigned) CPU_COUNT(&allowed);
+        l3_shift = cpuid_l3_shift();
+
+        topo = calloc(1, sizeof(*topo) + nb * sizeof(topo->cpu[0]));
+        args = calloc(nb, sizeof(*args));
+        if (!topo || !args || pthread_attr_init(&attr))
+                goto err;
+        pthread_attr_setstacksize(&attr, CPUID_SCAN_STACK);
+
+        for (int cpu = 0; cpu < CPU_SETSIZE && n < nb; cpu++) {
+                if (!CPU_ISSET((unsigned) cpu, &allowed))
+                        continue;
+
+                topo->cpu[n].cpu = cpu;
+                args[n].cpu = &topo->cpu[n];
+                args[n].l3_shift = l3_shift;
+                args[n].ret = -1;
+                if (pthread_create(&args[n].th, &attr,
+                                   cpuid_scan_thread, &args[n])) {
+                        failed = 1;
+                        break;
+                }
+                n++;
+        }
+        pthread_attr_destroy(&attr);
+
+        for (unsigned i = 0; i < n; i++) {
+                pthread_join(args[i].th, NULL);
+                if (args[i].ret)
+                        failed = 1;
+        }
+        if (failed)
+                goto err;
+
+        topo->nb = n;
+        free(args);
+        return topo;
+
+ err:
+        free(args);
+        free(topo);
+        return NULL;
+}
+
+void
+cpuid_topology_free(struct cpuid_topology *topo)
+{
+        free(topo);
+}
+
+static int
+cpuid_seen(const unsigned *keys,
+           unsigned nb,
+           unsigned key)
+{
+        for (unsigned i = 0; i < nb; i++) {
+                if (keys[i] == key)
+                        return 1;
+        }
+        return 0;
+}
+
+/*
+ * worker placement, fills cpus[] and returns the count
+ *  CPUID_PLAN_CORE: first thread of every physical core
+ *  CPUID_PLAN_L3:   all CPUs, those sharing a last level cache adjacent
+ */
+unsigned
+cpuid_topology_plan(const struct cpuid_topology *topo,
+                    enum cpuid_plan_e plan,
+                    int *cpus,
+                    unsigned nb)
+{
+        unsigned keys[topo->nb ? topo->nb : 1];
+        unsigned nb_keys = 0;
+        unsigned n = 0;
+
+        switch (plan) {
+        case CPUID_PLAN_CORE:
+                for (unsigned i = 0; i < topo->nb && n < nb; i++) {
+                        if (cpuid_seen(keys, nb_keys, topo->cpu[i].core))
+                                continue;
+                        keys[nb_keys++] = topo->cpu[i].core;
+                        cpus[n++] = topo->cpu[i].cpu;
+                }
+                break;
+
+        case CPUID_PLAN_L3:
+                for (unsigned i = 0; i < topo->nb; i++) {
+                        unsigned l3 = topo->cpu[i].l3;
+
+                        if (cpuid_seen(keys, nb_keys, l3))
+                                continue;
+                        keys[nb_keys++] = l3;
+                        for (unsigned j = i; j < topo->nb && n < nb; j++) {
+                                if (topo->cpu[j].l3 == l3)
+                                        cpus[n++] = topo->cpu[j].cpu;
+                        }
+                }
+                break;
+
+        default:
+                break;
+        }
+        return n;
+}
+
+/*
+ * CPUs grouped by core type, features of a group are those common
+ * to all its CPUs. returns the number of groups.
+ */
+unsigned
+cpuid_topology_groups(const struct cpuid_topology *topo,
+                      struct cpuid_core_group *groups,
+                      unsigned nb)
+{
+        unsigned n = 0;
+
+        for (unsigned i = 0; i < topo->nb; i++) {
+                const struct cpuid_cpu *cpu = &topo->cpu[i];
+                struct cpuid_core_group *group = NULL;
+
+                for (unsigned j = 0; j < n; j++) {
+                        if (groups[j].type == cpu->core_type) {
+                                group = &groups[j];
+                                break;
+                        }
+                }
+                if (!group) {
+                        if (n >= nb)
+                                continue;
+                        group = &groups[n++];
+                        group->type = cpu->core_type;
+                        group->nb = 0;
+                        group->features = cpu->features;
+                        CPU_ZERO(&group->cpus);
+                }
+
+                CPU_SET((unsigned) cpu->cpu, &group->cpus);
+                cpuid_features_and(&group->features, &group->features,
+                                   &cpu->features);
+                group->nb++;
+        }
+        return n;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_TSC		0x00000015U
+#define CPUID_LEAF_FREQ		0x00000016U
+
+#define CPUID_INTEL		0x756e6547U	/* "Genu" */
+#define CPUID_GOLDMONT		0x5c
+#define CPUID_GOLDMONT_HZ	19200000ULL
+
+#define CPUID_CALIBRATE_NS	10000000ULL	/* bound of the fallback */
+#define NSEC_PER_SEC		1000000000ULL
+
+static struct cpuid_tsc cpuid_tsc;
+static pthread_once_t cpuid_tsc_once = PTHREAD_ONCE_INIT;
+
+static uint64_t
+cpuid_clock_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * family 6 model, 0 if not Intel family 6
+ */
+static unsigned
+cpuid_intel_model(void)
+{
+        unsigned reg[4];
+        unsigned family;
+
+        if (cpuid_leaf_read(0, 0, reg) || reg[1] != CPUID_INTEL)
+                return 0;
+        if (cpuid_leaf_read(1, 0, reg))
+                return 0;
+        family = (reg[0] >> 8) & 0xf;
+        if (family != 6)
+                return 0;
+        return ((reg[0] >> 4) & 0xf) | (((reg[0] >> 16) & 0xf) << 4);
+}
+
+/*
+ * crystal clock times the TSC/crystal ratio of leaf 0x15,
+ * 0 when the leaf is missing or leaves the crystal out
+ */
+static uint64_t
+cpuid_tsc_leaf15(void)
+{
+        unsigned tsc[4];
+        uint64_t crystal;
+
+        if (cpuid_leaf_read(CPUID_LEAF_TSC, 0, tsc) || !tsc[0] || !tsc[1])
+                return 0;
+
+        crystal = tsc[2];
+        if (!crystal && cpuid_intel_model() == CPUID_GOLDMONT)
+                crystal = CPUID_GOLDMONT_HZ;
+        return crystal * tsc[1] / tsc[0];
+}
+
+/*
+ * base frequency of leaf 0x16, nominal and in whole MHz
+ */
+static uint64_t
+cpuid_tsc_leaf16(void)
+{
+        unsigned freq[4];
+
+        if (cpuid_leaf_read(CPUID_LEAF_FREQ, 0, freq))
+                return 0;
+        return (uint64_t) (freq[0] & 0xffff) * 1000000ULL;
+}
+
+/*
+ * bounded fallback against CLOCK_MONOTONIC_RAW
+ */
+static uint64_t
+cpuid_tsc_calibrate(void)
+{
+        uint64_t t0, c0, t1, c1;
+
+        t0 = cpuid_clock_ns();
+        c0 = cpuid_rdtsc();
+        do {
+                t1 = cpuid_clock_ns();
+                c1 = cpuid_rdtsc();
+        } while (t1 - t0 < CPUID_CALIBRATE_NS);
+
+        return (c1 - c0) * NSEC_PER_SEC / (t1 - t0);
+}
+
+/*
+ * ns = tsc * mult >> 32
+ */
+static void
+cpuid_tsc_scale(struct cpuid_tsc *tsc)
+{
+        tsc->shift = 32;
+        tsc->mult = tsc->hz ?
+                (uint64_t) (((unsigned __int128) NSEC_PER_SEC << 32) / tsc->hz) : 0;
+}
+
+static void
+cpuid_tsc_init(void)
+{
+        struct cpuid_tsc *tsc = &cpuid_tsc;
+        const struct cpuid_hv *hv = cpuid_hv_read();
+
+        tsc->invariant = cpuid_feature_test(cpuid_feature_id("invtsc"));
+        tsc->source = CPUID_TSC_SRC_NONE;
+        tsc->hz = 0;
+
+        if (!cpuid_feature_test(cpuid_feature_id("tsc")))
+                return;
+
+        /*
+         * exact rates first: a guest's 0x16 is the host's nominal
+         * clock, wrong once the TSC is scaled or the guest migrated
+         */
+        tsc->hz = cpuid_tsc_leaf15();
+        tsc->source = CPUID_TSC_SRC_LEAF15;
+        if (!tsc->hz && hv->tsc_khz) {
+                tsc->hz = (uint64_t) hv->tsc_khz * 1000;
+                tsc->source = CPUID_TSC_SRC_HYPERVISOR;
+        }
+        if (!tsc->hz) {
+                tsc->hz = cpuid_tsc_leaf16();
+                tsc->source = CPUID_TSC_SRC_LEAF16;
+        }
+        if (!tsc->hz) {
+                tsc->hz = cpuid_tsc_calibrate();
+                tsc->source = CPUID_TSC_SRC_CALIBRATED;
+        }
+        cpuid_tsc_scale(tsc);
+}
+
+/*
+ * TSC rate, calibrated at most once per process. -1 without a TSC.
+ */
+int
+cpuid_tsc_read(struct cpuid_tsc *tsc)
+{
+        pthread_once(&cpuid_tsc_once, cpuid_tsc_init);
+        *tsc = cpuid_tsc;
+        return cpuid_tsc.hz ? 0 : -1;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+#define CPUID_ERMS_MIN		2048	/* rep movsb beats vectors from here */
+#define CPUID_FSRM_MIN		256
+
+#define H_PDEP		CPUID_HINT_SLOW_PDEP
+#define H_DOWNCLOCK	CPUID_HINT_AVX512_DOWNCLOCK
+#define H_HALF		CPUID_HINT_AVX512_HALF
+#define H_SPLIT		CPUID_HINT_SPLIT_LOCK_TRAP
+
+static const struct {
+        const char *sig;	/* leaf 0 EBX:EDX:ECX */
+        enum cpuid_vendor_e vendor;
+} cpuid_vendor_sig[] = {
+        { "GenuineIntel", CPUID_VENDOR_INTEL, },
+        { "AuthenticAMD", CPUID_VENDOR_AMD, },
+        { "HygonGenuine", CPUID_VENDOR_HYGON, },
+        { "CentaurHauls", CPUID_VENDOR_ZHAOXIN, },
+        { "  Shanghai  ", CPUID_VENDOR_ZHAOXIN, },
+
+        { NULL,           CPUID_VENDOR_UNKNOWN, },	/* terminator */
+};
+
+static const char *cpuid_vendor_names[CPUID_VENDOR_NB] = {
+        [CPUID_VENDOR_UNKNOWN] = "unknown",
+        [CPUID_VENDOR_INTEL]   = "intel",
+        [CPUID_VENDOR_AMD]     = "amd",
+        [CPUID_VENDOR_HYGON]   = "hygon",
+        [CPUID_VENDOR_ZHAOXIN] = "zhaoxin",
+};
+
+/*
+ * first match wins: vendor, family, model and stepping ranges.
+ * hints are coarse defaults for dispatch, not measurements.
+ */
+struct cpuid_uarch_attr {
+        enum cpuid_vendor_e vendor;
+        unsigned family;
+        unsigned model_lo, model_hi;
+        unsigned stepping_lo, stepping_hi;
+        const char *name;
+        unsigned hints;
+        unsigned rep_movsb_min;
+};
+
+static const struct cpuid_uarch_attr cpuid_uarch_attr[] = {
+        { CPUID_VENDOR_INTEL, 6, 0x1a, 0x1a, 0, 15, "nehalem",        0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x1e, 0x1f, 0, 15, "nehalem",        0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x2e, 0x2e, 0, 15, "nehalem",        0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x25, 0x25, 0, 15, "westmere",       0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x2c, 0x2c, 0, 15, "westmere",       0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x2f, 0x2f, 0, 15, "westmere",       0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x2a, 0x2a, 0, 15, "sandybridge",    0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x2d, 0x2d, 0, 15, "sandybridge",    0, 0, },
+        { CPUID_VENDOR_INTEL, 6, 0x3a, 0x3a, 0, 15, "ivybridge",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x3e, 0x3e, 0, 15, "ivybridge",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x3c, 0x3c, 0, 15, "haswell",        0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x3f, 0x3f, 0, 15, "haswell",        0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x45, 0x46, 0, 15, "haswell",        0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x3d, 0x3d, 0, 15, "broadwell",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x47, 0x47, 0, 15, "broadwell",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x4f, 0x4f, 0, 15, "broadwell",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x56, 0x56, 0, 15, "broadwell",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x4e, 0x4e, 0, 15, "skylake",        0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x5e, 0x5e, 0, 15, "skylake",        0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x8e, 0x8e, 0, 15, "kabylake",       0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x9e, 0x9e, 0, 15, "kabylake",       0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xa5, 0xa6, 0, 15, "cometlake",      0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x55, 0x55, 0,  4, "skylake-x",      H_DOWNCLOCK, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x55, 0x55, 5,  7, "cascadelake",    H_DOWNCLOCK, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x55, 0x55, 8, 15, "cooperlake",     H_DOWNCLOCK, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x66, 0x66, 0, 15, "cannonlake",     H_DOWNCLOCK, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x7d, 0x7e, 0, 15, "icelake",        H_DOWNCLOCK, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x6a, 0x6a, 0, 15, "icelake-x",      H_DOWNCLOCK | H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x6c, 0x6c, 0, 15, "icelake-x",      H_DOWNCLOCK | H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x8c, 0x8d, 0, 15, "tigerlake",      H_DOWNCLOCK | H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xa7, 0xa7, 0, 15, "rocketlake",     H_DOWNCLOCK | H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x97, 0x97, 0, 15, "alderlake",      H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x9a, 0x9a, 0, 15, "alderlake",      H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xbe, 0xbe, 0, 15, "alderlake-n",    H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xb7, 0xb7, 0, 15, "raptorlake",     H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xba, 0xba, 0, 15, "raptorlake",     H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xbf, 0xbf, 0, 15, "raptorlake",     H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xaa, 0xaa, 0, 15, "meteorlake",     H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xac, 0xac, 0, 15, "meteorlake",     H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xbd, 0xbd, 0, 15, "lunarlake",      H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xc5, 0xc6, 0, 15, "arrowlake",      H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x8f, 0x8f, 0, 15, "sapphirerapids", H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xcf, 0xcf, 0, 15, "emeraldrapids",  H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xad, 0xae, 0, 15, "graniterapids",  H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xaf, 0xaf, 0, 15, "sierraforest",   H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0xdd, 0xdd, 0, 15, "clearwaterforest", H_SPLIT, CPUID_FSRM_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x5c, 0x5c, 0, 15, "goldmont",       0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x5f, 0x5f, 0, 15, "goldmont",       0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x7a, 0x7a, 0, 15, "goldmont-plus",  0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x86, 0x86, 0, 15, "tremont",        H_SPLIT, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x96, 0x96, 0, 15, "tremont",        H_SPLIT, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_INTEL, 6, 0x9c, 0x9c, 0, 15, "tremont",        H_SPLIT, CPUID_ERMS_MIN, },
+
+        /* before Zen 3, pdep/pext are microcoded: ~250 cycles */
+        { CPUID_VENDOR_AMD, 0x10, 0x00, 0xff, 0, 15, "k10",           0, 0, },
+        { CPUID_VENDOR_AMD, 0x15, 0x00, 0xff, 0, 15, "bulldozer",     H_PDEP, 0, },
+        { CPUID_VENDOR_AMD, 0x16, 0x00, 0xff, 0, 15, "jaguar",        0, 0, },
+        { CPUID_VENDOR_AMD, 0x17, 0x00, 0x2f, 0, 15, "zen",           H_PDEP, 0, },
+        { CPUID_VENDOR_AMD, 0x17, 0x30, 0xff, 0, 15, "zen2",          H_PDEP, 0, },
+        { CPUID_VENDOR_AMD, 0x19, 0x00, 0x0f, 0, 15, "zen3",          0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_AMD, 0x19, 0x10, 0x1f, 0, 15, "zen4",          H_HALF, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_AMD, 0x19, 0x20, 0x5f, 0, 15, "zen3",          0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_AMD, 0x19, 0x60, 0xaf, 0, 15, "zen4",          H_HALF, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_AMD, 0x1a, 0x00, 0xff, 0, 15, "zen5",          0, CPUID_ERMS_MIN, },
+        { CPUID_VENDOR_HYGON, 0x18, 0x00, 0xff, 0, 15, "dhyana",      H_PDEP, 0, },
+
+        { CPUID_VENDOR_UNKNOWN, 0, 0, 0, 0, 0, NULL, 0, 0, },	/* terminator */
+};
+
+/*
+ * vendor and display family/model/stepping from leaves 0 and 1,
+ * matched against cpuid_uarch_attr[]. name is NULL if unknown.
+ * 0 on success, -1 without leaf 1.
+ */
+int
+cpuid_uarch_read(struct cpuid_uarch *uarch)
+{
+        unsigned reg[4];
+        unsigned base;
+
+        memset(uarch, 0, sizeof(*uarch));
+        if (cpuid_leaf_read(0, 0, reg))
+                return -1;
+
+        memcpy(&uarch->vendor_str[0], &reg[1], 4);
+        memcpy(&uarch->vendor_str[4], &reg[3], 4);
+        memcpy(&uarch->vendor_str[8], &reg[2], 4);
+        uarch->vendor_str[12] = '\0';
+        for (unsigned i = 0; cpuid_vendor_sig[i].sig; i++) {
+                if (!memcmp(uarch->vendor_str, cpuid_vendor_sig[i].sig, 12)) {
+                        uarch->vendor = cpuid_vendor_sig[i].vendor;
+                        break;
+                }
+        }
+
+        if (cpuid_leaf_read(1, 0, reg))
+                return -1;
+
+        uarch->signature = reg[0];
+        uarch->stepping = reg[0] & 0xf;
+        base = (reg[0] >> 8) & 0xf;
+        uarch->family = base;
+        uarch->model = (reg[0] >> 4) & 0xf;
+        if (base == 0xf)
+                uarch->family += (reg[0] >> 20) & 0xff;
+        if (base == 0x6 || base == 0xf)
+                uarch->model |= ((reg[0] >> 16) & 0xf) << 4;
+
+        for (unsigned i = 0; cpuid_uarch_attr[i].name; i++) {
+                const struct cpuid_uarch_attr *attr = &cpuid_uarch_attr[i];
+
+                if (attr->vendor == uarch->vendor &&
+                    attr->family == uarch->family &&
+                    attr->model_lo <= uarch->model &&
+                    uarch->model <= attr->model_hi &&
+                    attr->stepping_lo <= uarch->stepping &&
+                    uarch->stepping <= attr->stepping_hi) {
+                        uarch->name = attr->name;
+                        uarch->hints = attr->hints;
+                        uarch->rep_movsb_min = attr->rep_movsb_min;
+                        break;
+                }
+        }
+        return 0;
+}
+
+const char *
+cpuid_vendor_name(enum cpuid_vendor_e vendor)
+{
+        if ((unsigned) vendor >= CPUID_VENDOR_NB)
+                return NULL;
+        return cpuid_vendor_names[vendor];
+}
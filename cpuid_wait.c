@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "cpuid.h"
+
+#define CPUID_UMWAIT_SYSFS	"/sys/devices/system/cpu/umwait_control/"
+#define CPUID_UMWAIT_C01	1u	/* umwait/tpause control: C0.1 */
+#define CPUID_UMWAIT_C02	0u	/* umwait/tpause control: C0.2 */
+
+#define CPUID_WAIT_C02_NS	10000ULL	/* shortest delay worth C0.2 */
+#define CPUID_WAIT_BACKOFF_NS	1000ULL		/* longest pause round */
+#define CPUID_WAIT_CALIBRATE	1024U		/* pauses per calibration run */
+#define NSEC_PER_SEC		1000000000ULL
+
+static struct cpuid_wait cpuid_wait;
+static pthread_once_t cpuid_wait_once = PTHREAD_ONCE_INIT;
+
+static const char *cpuid_wait_names[CPUID_WAIT_NB] = {
+        [CPUID_WAIT_PAUSE]  = "pause",
+        [CPUID_WAIT_UMWAIT] = "umwait",
+};
+
+static inline uint64_t
+cpuid_wait_ticks(uint64_t ns)
+{
+        return (uint64_t) (((unsigned __int128) ns * cpuid_wait.tsc.hz) /
+                           NSEC_PER_SEC);
+}
+
+/*
+ * decimal sysfs attribute, -1 if absent
+ */
+static int
+cpuid_wait_sysfs(const char *name,
+                 uint64_t *val)
+{
+        char path[128], buf[32];
+        ssize_t len;
+        int fd;
+
+        snprintf(path, sizeof(path), "%s%s", CPUID_UMWAIT_SYSFS, name);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+        len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0)
+                return -1;
+        buf[len] = '\0';
+        *val = strtoull(buf, NULL, 10);
+        return 0;
+}
+
+/*
+ * TSC ticks per pause, best of a few runs: 10 to 140 cycles
+ * depending on the core, far more under some hypervisors
+ */
+static void
+cpuid_wait_calibrate(struct cpuid_wait *w)
+{
+        uint64_t best = UINT64_MAX;
+        uint64_t round;
+
+        for (unsigned run = 0; run < 4; run++) {
+                uint64_t t = cpuid_rdtsc();
+
+                for (unsigned i = 0; i < CPUID_WAIT_CALIBRATE; i++)
+                        __builtin_ia32_pause();
+                t = cpuid_rdtsc() - t;
+                if (t < best)
+                        best = t;
+        }
+        w->pause_ticks = best / CPUID_WAIT_CALIBRATE;
+        if (!w->pause_ticks)
+                w->pause_ticks = 1;
+
+        /* longest backoff round that still notices a store within ~1us */
+        round = cpuid_wait_ticks(CPUID_WAIT_BACKOFF_NS) / w->pause_ticks;
+        w->backoff_max = 1;
+        while (w->backoff_max * 2 <= round)
+                w->backoff_max *= 2;
+}
+
+static void
+cpuid_wait_init(void)
+{
+        struct cpuid_wait *w = &cpuid_wait;
+        uint64_t val;
+
+        memset(w, 0, sizeof(*w));
+        w->method = CPUID_WAIT_PAUSE;
+        cpuid_tsc_read(&w->tsc);
+        cpuid_wait_calibrate(w);
+
+        if (cpuid_feature_test(CPUID_FEATURE_WAITPKG) <= 0 ||
+            cpuid_backend_get() != &cpuid_backend_live)
+                return;
+
+        /* IA32_UMWAIT_CONTROL reset value: C0.2 allowed, no limit */
+        w->waitpkg = 1;
+        w->c02 = 1;
+        if (!cpuid_wait_sysfs("enable_c02", &val))
+                w->c02 = val ? 1 : 0;
+        if (!cpuid_wait_sysfs("max_time", &val))
+                w->max_time = val;
+
+        /* an OS limit shorter than a pause round wakes umwait more often */
+        if (!w->max_time ||
+            w->max_time >= (uint64_t) w->backoff_max * w->pause_ticks)
+                w->method = CPUID_WAIT_UMWAIT;
+}
+
+/*
+ * pause with exponential backoff
+ */
+static int
+cpuid_wait_pause(const volatile uint64_t *addr,
+                 uint64_t old,
+                 uint64_t ticks)
+{
+        uint64_t start = cpuid_rdtsc();
+        unsigned n = 1;
+
+        while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == old) {
+                if (ticks && cpuid_rdtsc() - start >= ticks)
+                        return -1;
+                for (unsigned i = 0; i < n; i++)
+                        __builtin_ia32_pause();
+                if (n < cpuid_wait.backoff_max)
+                        n <<= 1;
+        }
+        return 0;
+}
+
+/*
+ * umonitor the line, umwait in C0.1 until a store or the deadline;
+ * the OS max_time may cut a umwait short, so the monitor is re-armed
+ * after each wake
+ */
+__attribute__((target("waitpkg")))
+static int
+cpuid_wait_umwait(const volatile uint64_t *addr,
+                  uint64_t old,
+                  uint64_t ticks)
+{
+        uint64_t start = cpuid_rdtsc();
+        uint64_t deadline = ticks ? start + ticks : UINT64_MAX;
+
+        while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == old) {
+                if (ticks && cpuid_rdtsc() - start >= ticks)
+                        return -1;
+                _umonitor((void *) (uintptr_t) addr);
+                if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != old)
+                        break;
+                _umwait(CPUID_UMWAIT_C01, deadline);
+        }
+        return 0;
+}
+
+__attribute__((target("waitpkg")))
+static void
+cpuid_wait_tpause(uint64_t deadline,
+                  unsigned ctrl)
+{
+        while (cpuid_rdtsc() < deadline)
+                _tpause(ctrl, deadline);
+}
+
+/*
+ * method and calibration, resolved once per process
+ */
+const struct cpuid_wait *
+cpuid_wait_read(void)
+{
+        pthread_once(&cpuid_wait_once, cpuid_wait_init);
+        return &cpuid_wait;
+}
+
+const char *
+cpuid_wait_name(enum cpuid_wait_e method)
+{
+        if ((unsigned) method >= CPUID_WAIT_NB)
+                return NULL;
+        return cpuid_wait_names[method];
+}
+
+/*
+ * override the detected method, -1 if it is not usable here
+ */
+int
+cpuid_wait_select(enum cpuid_wait_e method)
+{
+        cpuid_wait_read();
+        if ((unsigned) method >= CPUID_WAIT_NB ||
+            (method == CPUID_WAIT_UMWAIT && !cpuid_wait.waitpkg))
+                return -1;
+        __atomic_store_n(&cpuid_wait.method, method, __ATOMIC_RELAXED);
+        return 0;
+}
+
+/*
+ * wait while *addr == old, at most ns nanoseconds (0: no limit).
+ * 0 once the value changed, -1 on timeout.
+ */
+int
+cpuid_wait_until(const volatile uint64_t *addr,
+                 uint64_t old,
+                 uint64_t ns)
+{
+        uint64_t ticks;
+
+        cpuid_wait_read();
+        ticks = ns ? cpuid_wait_ticks(ns) : 0;
+        if (ns && !ticks)
+                ticks = 1;
+        if (__atomic_load_n(&cpuid_wait.method, __ATOMIC_RELAXED) ==
+            CPUID_WAIT_UMWAIT)
+                return cpuid_wait_umwait(addr, old, ticks);
+        return cpuid_wait_pause(addr, old, ticks);
+}
+
+/*
+ * busy delay of ns nanoseconds, tpause when available; C0.2 only
+ * for delays long enough to hide its exit latency
+ */
+void
+cpuid_wait_delay(uint64_t ns)
+{
+        uint64_t deadline;
+
+        cpuid_wait_read();
+        deadline = cpuid_rdtsc() + cpuid_wait_ticks(ns);
+        if (__atomic_load_n(&cpuid_wait.method, __ATOMIC_RELAXED) ==
+            CPUID_WAIT_UMWAIT) {
+                cpuid_wait_tpause(deadline,
+                                  (cpuid_wait.c02 && ns >= CPUID_WAIT_C02_NS) ?
+                                  CPUID_UMWAIT_C02 : CPUID_UMWAIT_C01);
+                return;
+        }
+        while (cpuid_rdtsc() < deadline)
+                __builtin_ia32_pause();
+}
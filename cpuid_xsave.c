@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cpuid.h"
+
+#define CPUID_LEAF_XSAVE	0x0000000dU
+
+#define CPUID_XSAVE_LEGACY	512	/* x87/SSE area */
+#define CPUID_XSAVE_HEADER	64
+
+/*
+ * XSAVE area layout from leaf 0xD: sub-leaf 0/1 give the sizes and
+ * the supported masks, sub-leaf i >= 2 describes component i.
+ * 0 on success, -1 without XSAVE.
+ */
+int
+cpuid_xsave_read(struct cpuid_xsave *xs)
+{
+        unsigned reg[4];
+
+        memset(xs, 0, sizeof(*xs));
+        if (cpuid_leaf_read(CPUID_LEAF_XSAVE, 0, reg))
+                return -1;
+
+        xs->user_mask = ((uint64_t) reg[3] << 32) | reg[0];
+        xs->size = reg[1];
+        xs->max_size = reg[2];
+        xs->enabled = cpuid_xcr0();
+
+        if (!cpuid_leaf_read(CPUID_LEAF_XSAVE, 1, reg)) {
+                xs->xsaves_size = reg[1];
+                xs->supervisor_mask = ((uint64_t) reg[3] << 32) | reg[2];
+        }
+
+        /* x87 and SSE live in the legacy area */
+        xs->comp[0].size = 160;
+        xs->comp[0].offset = 0;
+        xs->comp[1].size = 256;
+        xs->comp[1].offset = 160;
+
+        for (unsigned i = 2; i < CPUID_XSAVE_MAX; i++) {
+                struct cpuid_xsave_comp *comp = &xs->comp[i];
+
+                if (!((xs->user_mask | xs->supervisor_mask) & (1ULL << i)) ||
+                    cpuid_leaf_read(CPUID_LEAF_XSAVE, i, reg))
+                        continue;
+
+                comp->size = reg[0];
+                comp->offset = reg[1];			/* 0 if supervisor */
+                comp->supervisor = reg[2] & 0x1;
+                comp->align64 = (reg[2] >> 1) & 0x1;
+                comp->xfd = (reg[2] >> 2) & 0x1;
+        }
+
+        xs->compacted_size = cpuid_xsave_size(xs, xs->enabled, 1);
+        return 0;
+}
+
+/*
+ * bytes needed to save the components in mask, in the standard
+ * (XSAVE/XSAVEOPT) or compacted (XSAVEC/XSAVES) format
+ */
+unsigned
+cpuid_xsave_size(const struct cpuid_xsave *xs,
+                 uint64_t mask,
+                 int compacted)
+{
+        unsigned size = CPUID_XSAVE_LEGACY + CPUID_XSAVE_HEADER;
+
+        for (unsigned i = 2; i < CPUID_XSAVE_MAX; i++) {
+                const struct cpuid_xsave_comp *comp = &xs->comp[i];
+
+                if (!(mask & (1ULL << i)) || !comp->size)
+                        continue;
+
+                if (compacted) {
+                        if (comp->align64)
+                                size = (size + 63) & ~63u;
+                        size += comp->size;
+                } else if (comp->offset + comp->size > size) {
+                        size = comp->offset + comp->size;
+                }
+        }
+        return size;
+}
+
+/*
+ * offset of component i in the compacted format for mask,
+ * 0 if i is not in mask
+ */
+unsigned
+cpuid_xsave_offset(const struct cpuid_xsave *xs,
+                   uint64_t mask,
+                   unsigned i)
+{
+        unsigned offset;
+
+        if (i >= CPUID_XSAVE_MAX || !(mask & (1ULL << i)))
+                return 0;
+        if (i < 2)
+                return xs->comp[i].offset;
+
+        /* where the components below i end */
+        offset = cpuid_xsave_size(xs, mask & ((1ULL << i) - 1), 1);
+        if (xs->comp[i].align64)
+                offset = (offset + 63) & ~63u;
+        return offset;
+}
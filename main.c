@@ -28,10 +28,30 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 
 #include "cpuid.h"
 
 
+enum out_fmt_e {
+        OUT_TEXT = 0,
+        OUT_JSON,
+        OUT_ENV,
+        OUT_HEADER,
+
+        OUT_NB,
+};
+
+static const char *out_names[OUT_NB] = {
+        [OUT_TEXT]   = "text",
+        [OUT_JSON]   = "json",
+        [OUT_ENV]    = "env",
+        [OUT_HEADER] = "header",
+};
+
+/* features reported without -a or names */
 const char *cpuid_names[] = {
         "sse3",
         "ssse3",
@@ -47,17 +67,383 @@ const char *cpuid_names[] = {
         NULL,	/* terminator */
 };
 
-int
-main(void)
+static int
+probe_print(void)
 {
-        unsigned flags = cpuid_flags_read(cpuid_names);
+        static const char *width[CPUID_VEC_NB] = { "128", "256", "512", };
+        struct cpuid_simd_probe res;
 
-        for (unsigned i = 0; cpuid_names[i]; i++) {
-                if (flags & (1u << i))
-                        fprintf(stderr, "%s enabled\n", cpuid_names[i]);
+        if (cpuid_probe_simd(&res)) {
+                fprintf(stderr, "probe needs the live cpuid backend\n");
+                return 1;
+        }
+
+        printf("scalar clock %.3f x TSC\n", res.base_clock);
+        for (unsigned w = 0; w < CPUID_VEC_NB; w++) {
+                if (!res.width[w].usable)
+                        printf("%s-bit unusable\n", width[w]);
                 else
-                        fprintf(stderr, "%s disabled\n", cpuid_names[i]);
+                        printf("%s-bit %.2f flops/cycle clock %.3f x TSC\n",
+                               width[w], res.width[w].flops,
+                               res.width[w].clock);
         }
+        printf("preferred %s-bit\n", width[res.preferred]);
+        return 0;
+}
+
+static int
+xsave_print(void)
+{
+        struct cpuid_xsave xs;
+        struct cpuid_amx amx;
+
+        if (cpuid_xsave_read(&xs)) {
+                fprintf(stderr, "no XSAVE\n");
+                return 1;
+        }
+
+        printf("xcr0 %#llx supported %#llx xss %#llx\n",
+               (unsigned long long) xs.enabled,
+               (unsigned long long) xs.user_mask,
+               (unsigned long long) xs.supervisor_mask);
+        printf("size %u max %u compacted %u xsaves %u\n",
+               xs.size, xs.max_size, xs.compacted_size, xs.xsaves_size);
+        for (unsigned i = 2; i < CPUID_XSAVE_MAX; i++) {
+                const struct cpuid_xsave_comp *comp = &xs.comp[i];
+
+                if (!comp->size)
+                        continue;
+                printf("%2u size %5u offset %5u compacted %5u%s%s%s\n",
+                       i, comp->size, comp->offset,
+                       cpuid_xsave_offset(&xs, xs.enabled, i),
+                       comp->supervisor ? " supervisor" : "",
+                       comp->align64 ? " align64" : "",
+                       comp->xfd ? " xfd" : "");
+        }
+
+        if (!cpuid_amx_read(&amx)) {
+                printf("amx %u tiles x %u rows x %u bytes, tmul k %u n %u, %s\n",
+                       amx.tiles, amx.max_rows, amx.bytes_per_row,
+                       amx.tmul_maxk, amx.tmul_maxn,
+                       cpuid_amx_enable() ? "not permitted" : "permitted");
+        }
+        return 0;
+}
+
+/*
+ * prefix and name upper-cased, anything else than [A-Z0-9] as '_'
+ */
+static const char *
+macro_name(char *buf,
+           size_t len,
+           const char *prefix,
+           const char *name)
+{
+        size_t n = strlen(prefix);
+
+        if (n >= len)
+                n = len - 1;
+        memcpy(buf, prefix, n);
+        for (; *name && n + 1 < len; name++, n++)
+                buf[n] = isalnum((unsigned char) *name) ?
+                         (char) toupper((unsigned char) *name) : '_';
+        buf[n] = '\0';
+        return buf;
+}
+
+/*
+ * JSON string, control characters and quotes escaped
+ */
+static void
+json_string(const char *str)
+{
+        putchar('"');
+        for (; *str; str++) {
+                unsigned char c = (unsigned char) *str;
+
+                if (c == '"' || c == '\\')
+                        printf("\\%c", c);
+                else if (c < 0x20)
+                        printf("\\u%04x", c);
+                else
+                        putchar(c);
+        }
+        putchar('"');
+}
+
+static void
+text_print(const char **names)
+{
+        const struct cpuid_hv *hv;
+        const struct cpuid_wait *wait;
+        struct cpuid_uarch uarch;
+        struct cpuid_rdt rdt;
+        struct cpuid_mem mem;
+        const char *name;
+        static const char *flush[] = {
+                "none", "clflush", "clflushopt", "clwb",
+        };
+
+        if (!cpuid_uarch_read(&uarch))
+                fprintf(stderr, "%s family %#x model %#x stepping %u: %s\n",
+                        uarch.vendor_str, uarch.family, uarch.model,
+                        uarch.stepping, uarch.name ? uarch.name : "unknown");
+
+        if (!cpuid_rdt_read(&rdt)) {
+                if (rdt.mon.rmids)
+                        fprintf(stderr, "rdt monitoring %u rmids\n",
+                                rdt.mon.rmids);
+                if (rdt.l3.cbm_len)
+                        fprintf(stderr, "rdt l3 %u ways %u clos\n",
+                                rdt.l3.cbm_len, rdt.l3.clos);
+                if (rdt.l2.cbm_len)
+                        fprintf(stderr, "rdt l2 %u ways %u clos\n",
+                                rdt.l2.cbm_len, rdt.l2.clos);
+                if (rdt.mba.clos)
+                        fprintf(stderr, "rdt mba %u clos\n", rdt.mba.clos);
+        }
+
+        cpuid_mem_read(&mem);
+        fprintf(stderr, "flush %s line %u%s%s%s\n", flush[mem.flush],
+                mem.clflush_size,
+                (mem.flags & CPUID_MEM_F_WAITPKG) ? " umwait" : "",
+                (mem.flags & CPUID_MEM_F_MOVDIR64B) ? " movdir64b" : "",
+                (mem.flags & CPUID_MEM_F_FSRM) ? " fsrm" : "");
 
+        wait = cpuid_wait_read();
+        if (wait->method == CPUID_WAIT_UMWAIT)
+                fprintf(stderr, "wait umwait max_time %llu%s\n",
+                        (unsigned long long) wait->max_time,
+                        wait->c02 ? " c0.2" : "");
+        else
+                fprintf(stderr, "wait pause %llu ticks backoff %u\n",
+                        (unsigned long long) wait->pause_ticks,
+                        wait->backoff_max);
+
+        hv = cpuid_hv_read();
+        if (hv->kind != CPUID_HV_NONE) {
+                fprintf(stderr, "hypervisor %s \"%s\"\n",
+                        cpuid_hv_name(hv->kind), hv->vendor);
+                for (unsigned i = 0; (name = cpuid_hv_flag_name(i)); i++) {
+                        if (cpuid_hv_flag_test(name) > 0)
+                                fprintf(stderr, "  %s\n", name);
+                }
+        }
+
+        for (unsigned i = 0; names[i]; i++) {
+                if (cpuid_feature_test(cpuid_feature_id(names[i])) > 0)
+                        fprintf(stderr, "%s enabled\n", names[i]);
+                else
+                        fprintf(stderr, "%s disabled\n", names[i]);
+        }
+}
+
+static void
+json_print(const char **names)
+{
+        struct cpuid_uarch uarch;
+
+        cpuid_uarch_read(&uarch);
+        printf("{\n  \"vendor\": ");
+        json_string(uarch.vendor_str);
+        printf(",\n  \"family\": %u,\n  \"model\": %u,\n  \"stepping\": %u,\n",
+               uarch.family, uarch.model, uarch.stepping);
+        printf("  \"uarch\": ");
+        if (uarch.name)
+                json_string(uarch.name);
+        else
+                printf("null");
+        printf(",\n  \"isa_level\": ");
+        json_string(cpuid_isa_name(cpuid_isa_level(NULL)));
+        printf(",\n  \"hypervisor\": ");
+        json_string(cpuid_hv_name(cpuid_hv_read()->kind));
+        printf(",\n  \"xcr0\": %llu,\n  \"features\": {",
+               (unsigned long long) cpuid_xcr0());
+        for (unsigned i = 0; names[i]; i++) {
+                printf("%s\n    ", i ? "," : "");
+                json_string(names[i]);
+                printf(": %s",
+                       cpuid_feature_test(cpuid_feature_id(names[i])) > 0 ?
+                       "true" : "false");
+        }
+        printf("\n  }\n}\n");
+}
+
+/*
+ * shell-sourceable, values are never quoted-unsafe
+ */
+static void
+env_print(const char **names)
+{
+        struct cpuid_uarch uarch;
+        char macro[64];
+
+        cpuid_uarch_read(&uarch);
+        printf("CPUID_VENDOR='%s'\n", cpuid_vendor_name(uarch.vendor));
+        printf("CPUID_FAMILY=%u\nCPUID_MODEL=%u\nCPUID_STEPPING=%u\n",
+               uarch.family, uarch.model, uarch.stepping);
+        printf("CPUID_UARCH='%s'\n", uarch.name ? uarch.name : "");
+        printf("CPUID_ISA_LEVEL='%s'\n", cpuid_isa_name(cpuid_isa_level(NULL)));
+        printf("CPUID_HYPERVISOR='%s'\n",
+               cpuid_hv_name(cpuid_hv_read()->kind));
+        for (unsigned i = 0; names[i]; i++) {
+                printf("%s=%d\n",
+                       macro_name(macro, sizeof(macro), "CPUID_HAVE_", names[i]),
+                       cpuid_feature_test(cpuid_feature_id(names[i])) > 0);
+        }
+}
+
+static void
+header_print(const char **names)
+{
+        struct cpuid_uarch uarch;
+        char macro[64];
+
+        cpuid_uarch_read(&uarch);
+        printf("/* generated by cpuid for %s family %#x model %#x (%s) */\n",
+               cpuid_vendor_name(uarch.vendor), uarch.family, uarch.model,
+               uarch.name ? uarch.name : "unknown");
+        printf("#ifndef _CPUID_CONFIG_H_\n#define _CPUID_CONFIG_H_\n\n");
+        printf("#define CPUID_ISA_LEVEL %d\n\n", (int) cpuid_isa_level(NULL));
+        for (unsigned i = 0; names[i]; i++) {
+                macro_name(macro, sizeof(macro), "HAVE_", names[i]);
+                if (cpuid_feature_test(cpuid_feature_id(names[i])) > 0)
+                        printf("#define %s 1\n", macro);
+                else
+                        printf("/* #undef %s */\n", macro);
+        }
+        printf("\n#endif /* !_CPUID_CONFIG_H_ */\n");
+}
+
+static void
+usage(const char *prog)
+{
+        fprintf(stderr,
+                "Usage: %s [-l snapshot | -r dump] [-w snapshot] [-d] [-p] [-x]\n"
+                "       [-f text|json|env|header] [-a | feature ...]\n"
+                "  -l FILE  use the snapshot FILE instead of probing\n"
+                "  -r FILE  replay the registers of a \"cpuid -r\" dump\n"
+                "  -w FILE  write the snapshot to FILE\n"
+                "  -d       dump the registers in \"cpuid -r\" layout\n"
+                "  -p       probe the SIMD throughput of each vector width\n"
+                "  -x       print the XSAVE area and AMX tile layout\n"
+                "  -f FMT   text on stderr (default), or json, key=value or\n"
+                "           a C header with HAVE_<FEATURE> on stdout\n"
+                "  -a       report every known feature\n",
+                prog);
+}
+
+int
+main(int argc,
+     char **argv)
+{
+        static const char *all[CPUID_FEATURE_MAX + 1];
+        struct cpuid_backend dump;
+        enum out_fmt_e fmt = OUT_TEXT;
+        const char **names = cpuid_names;
+        const char *wfile = NULL;
+        int raw = 0;
+        int probe = 0;
+        int xsave = 0;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "l:r:w:dpxf:ah")) != -1) {
+                switch (opt) {
+                case 'l':
+                        if (cpuid_snapshot_load(optarg)) {
+                                fprintf(stderr, "%s: not a valid snapshot\n",
+                                        optarg);
+                                return 1;
+                        }
+                        break;
+                case 'r':
+                        if (cpuid_dump_open(&dump, optarg) ||
+                            cpuid_backend_set(&dump)) {
+                                fprintf(stderr, "%s: not a valid dump\n",
+                                        optarg);
+                                return 1;
+                        }
+                        break;
+                case 'w':
+                        wfile = optarg;
+                        break;
+                case 'd':
+                        raw = 1;
+                        break;
+                case 'p':
+                        probe = 1;
+                        break;
+                case 'x':
+                        xsave = 1;
+                        break;
+                case 'f':
+                        for (fmt = OUT_TEXT; fmt < OUT_NB; fmt++) {
+                                if (!strcmp(optarg, out_names[fmt]))
+                                        break;
+                        }
+                        if (fmt == OUT_NB) {
+                                fprintf(stderr, "%s: unknown format\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'a':
+                        for (int id = 0; (all[id] = cpuid_feature_name(id)); id++)
+                                ;
+                        names = all;
+                        break;
+                case 'h':
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+
+        if (optind < argc) {
+                if (names == all || argc - optind > CPUID_FEATURE_MAX) {
+                        usage(argv[0]);
+                        return 1;
+                }
+                for (int i = optind; i < argc; i++) {
+                        if (cpuid_feature_id(argv[i]) < 0) {
+                                fprintf(stderr, "%s: unknown feature\n", argv[i]);
+                                return 1;
+                        }
+                        all[i - optind] = argv[i];
+                }
+                all[argc - optind] = NULL;
+                names = all;
+        }
+
+        if (wfile) {
+                if (cpuid_snapshot_write(wfile)) {
+                        perror(wfile);
+                        return 1;
+                }
+                return 0;
+        }
+        if (raw) {
+                cpuid_dump_write(stdout);
+                return 0;
+        }
+
+        if (probe)
+                return probe_print();
+        if (xsave)
+                return xsave_print();
+
+        switch (fmt) {
+        case OUT_JSON:
+                json_print(names);
+                break;
+        case OUT_ENV:
+                env_print(names);
+                break;
+        case OUT_HEADER:
+                header_print(names);
+                break;
+        default:
+                text_print(names);
+                break;
+        }
         return 0;
 }
@@ -0,0 +1,879 @@
+/*
+ * Copyright (c) 2017, deadcafe.beef@gmail.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the name of the project nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "cpuid.h"
+
+#define TEST_SUM_NB	1027U		/* not a multiple of any width */
+
+static unsigned test_failed;
+
+__attribute__((format(printf, 2, 3)))
+static void
+test_check(int ok,
+           const char *fmt,
+           ...)
+{
+        va_list ap;
+
+        if (ok)
+                return;
+        test_failed++;
+        fprintf(stderr, "FAIL: ");
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+}
+
+/*
+ * one function, one variant per vector width
+ */
+typedef uint32_t (*test_sum_t)(const uint32_t *v, unsigned nb);
+
+static uint32_t
+test_sum_c(const uint32_t *v,
+           unsigned nb)
+{
+        uint32_t sum = 0;
+
+        for (unsigned i = 0; i < nb; i++)
+                sum += v[i];
+        return sum;
+}
+
+static uint32_t
+test_sum_sse2(const uint32_t *v,
+              unsigned nb)
+{
+        __m128i acc = _mm_setzero_si128();
+        uint32_t lane[4];
+        unsigned i;
+
+        for (i = 0; i + 4 <= nb; i += 4)
+                acc = _mm_add_epi32(acc, _mm_loadu_si128((const void *) &v[i]));
+        _mm_storeu_si128((void *) lane, acc);
+        return lane[0] + lane[1] + lane[2] + lane[3] +
+               test_sum_c(&v[i], nb - i);
+}
+
+__attribute__((target("sse4.1")))
+static uint32_t
+test_sum_sse41(const uint32_t *v,
+               unsigned nb)
+{
+        __m128i acc = _mm_setzero_si128();
+        uint32_t sum;
+        unsigned i;
+
+        for (i = 0; i + 4 <= nb; i += 4)
+                acc = _mm_add_epi32(acc, _mm_loadu_si128((const void *) &v[i]));
+        sum = (uint32_t) _mm_extract_epi32(acc, 0);
+        sum += (uint32_t) _mm_extract_epi32(acc, 1);
+        sum += (uint32_t) _mm_extract_epi32(acc, 2);
+        sum += (uint32_t) _mm_extract_epi32(acc, 3);
+        return sum + test_sum_c(&v[i], nb - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+test_sum_avx2(const uint32_t *v,
+              unsigned nb)
+{
+        __m256i acc = _mm256_setzero_si256();
+        uint32_t lane[8], sum = 0;
+        unsigned i;
+
+        for (i = 0; i + 8 <= nb; i += 8)
+                acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const void *)
+                                                               &v[i]));
+        _mm256_storeu_si256((void *) lane, acc);
+        for (unsigned l = 0; l < 8; l++)
+                sum += lane[l];
+        return sum + test_sum_c(&v[i], nb - i);
+}
+
+__attribute__((target("avx512f")))
+static uint32_t
+test_sum_avx512(const uint32_t *v,
+                unsigned nb)
+{
+        __m512i acc = _mm512_setzero_si512();
+        unsigned i;
+
+        for (i = 0; i + 16 <= nb; i += 16)
+                acc = _mm512_add_epi32(acc, _mm512_loadu_si512(&v[i]));
+        return (uint32_t) _mm512_reduce_add_epi32(acc) +
+               test_sum_c(&v[i], nb - i);
+}
+
+static const char *test_sse2[]   = { "sse2", NULL, };
+static const char *test_sse41[]  = { "sse4.1", NULL, };
+static const char *test_avx2[]   = { "avx2", NULL, };
+static const char *test_avx512[] = { "avx512f", NULL, };
+
+static const struct cpuid_impl test_sum_impls[] = {
+        CPUID_IMPL(test_sum_c,      NULL,        0),
+        CPUID_IMPL(test_sum_sse2,   test_sse2,   10),
+        CPUID_IMPL(test_sum_sse41,  test_sse41,  20),
+        CPUID_IMPL(test_sum_avx2,   test_avx2,   30),
+        CPUID_IMPL(test_sum_avx512, test_avx512, 40),
+};
+
+/* dropped one after the other, best first */
+static const char *test_drop[] = {
+        "avx512f", "avx2", "sse4.1", "sse2",
+        NULL,	/* terminator */
+};
+
+/*
+ * the host may lack what the dump has: run a variant only if
+ * the CPU the test runs on has it
+ */
+static int
+test_host_has(const char **features)
+{
+        __builtin_cpu_init();
+        for (unsigned i = 0; features && features[i]; i++) {
+                const char *f = features[i];
+
+                if (!strcmp(f, "sse2") && !__builtin_cpu_supports("sse2"))
+                        return 0;
+                if (!strcmp(f, "sse4.1") && !__builtin_cpu_supports("sse4.1"))
+                        return 0;
+                if (!strcmp(f, "avx2") && !__builtin_cpu_supports("avx2"))
+                        return 0;
+                if (!strcmp(f, "avx512f") && !__builtin_cpu_supports("avx512f"))
+                        return 0;
+        }
+        return 1;
+}
+
+/*
+ * highest priority impl that has is enough for, the rule
+ * cpuid_impl_select() must follow
+ */
+static const struct cpuid_impl *
+test_dispatch_expect(const struct cpuid_features *have)
+{
+        for (unsigned i = CPUID_IMPL_NB(test_sum_impls); i-- > 0;) {
+                struct cpuid_features want;
+
+                cpuid_features_zero(&want);
+                if (test_sum_impls[i].features)
+                        cpuid_features_from_names(&want,
+                                                  test_sum_impls[i].features);
+                if (cpuid_features_has_all(have, &want))
+                        return &test_sum_impls[i];
+        }
+        return NULL;
+}
+
+/*
+ * every variant picked with exactly its features, the right one
+ * with the snapshot reduced step by step, directly and through
+ * CPUID_MASK, and every variant the host runs agrees
+ */
+static void
+test_dispatch(void)
+{
+        const unsigned nb = CPUID_IMPL_NB(test_sum_impls);
+        const struct cpuid_impl *impl, *expect;
+        struct cpuid_features have;
+        char mask[128] = "";
+        uint32_t v[TEST_SUM_NB], ref;
+
+        for (unsigned i = 0; i < nb; i++) {
+                const struct cpuid_impl *own = &test_sum_impls[i];
+
+                cpuid_features_zero(&have);
+                if (own->features)
+                        cpuid_features_from_names(&have, own->features);
+                impl = cpuid_impl_select(test_sum_impls, nb, &have);
+                test_check(impl == own, "%s not picked with its features",
+                           own->name);
+        }
+
+        cpuid_features_read(&have);
+        for (unsigned step = 0; ; step++) {
+                expect = test_dispatch_expect(&have);
+
+                impl = cpuid_impl_select(test_sum_impls, nb, &have);
+                test_check(impl == expect, "step %u: %s picked, %s expected",
+                           step, impl ? impl->name : "none",
+                           expect ? expect->name : "none");
+
+                setenv("CPUID_MASK", mask, 1);
+                impl = cpuid_impl_select(test_sum_impls, nb, NULL);
+                test_check(impl == expect,
+                           "CPUID_MASK=%s: %s picked, %s expected", mask,
+                           impl ? impl->name : "none",
+                           expect ? expect->name : "none");
+
+                if (!test_drop[step])
+                        break;
+                cpuid_features_clear(&have, cpuid_feature_id(test_drop[step]));
+                if (step)
+                        strcat(mask, ",");
+                strcat(mask, test_drop[step]);
+        }
+        unsetenv("CPUID_MASK");
+
+        for (unsigned i = 0; i < TEST_SUM_NB; i++)
+                v[i] = i * 2654435761U;
+        ref = test_sum_c(v, TEST_SUM_NB);
+        for (unsigned i = 1; i < nb; i++) {
+                test_sum_t fn = (test_sum_t) test_sum_impls[i].fn;
+
+                if (!test_host_has(test_sum_impls[i].features))
+                        continue;
+                test_check(fn(v, TEST_SUM_NB) == ref, "%s disagrees with %s",
+                           test_sum_impls[i].name, test_sum_impls[0].name);
+        }
+}
+
+/*
+ * the ifunc path: resolved by the loader from plain cpuid, so the
+ * host CPU whatever CPUID_MASK or dump the test runs with
+ */
+static uint32_t test_sum(const uint32_t *v, unsigned nb)
+        __attribute__((ifunc("test_sum_resolver")));
+
+CPUID_IFUNC_RESOLVER(test_sum, test_sum_impls)
+
+static void
+test_ifunc(void)
+{
+        const unsigned nb = CPUID_IMPL_NB(test_sum_impls);
+        const struct cpuid_impl *impl, *expect;
+        struct cpuid_features live, snap;
+        uint32_t v[TEST_SUM_NB];
+
+        cpuid_features_live(&live);
+        if (cpuid_backend_get() == &cpuid_backend_live) {
+                cpuid_features_read(&snap);
+                test_check(cpuid_features_equal(&live, &snap),
+                           "cpuid_features_live() disagrees with the snapshot");
+        }
+
+        expect = test_dispatch_expect(&live);
+        impl = cpuid_impl_resolve(test_sum_impls, nb);
+        test_check(impl == expect, "resolver: %s picked, %s expected",
+                   impl ? impl->name : "none",
+                   expect ? expect->name : "none");
+
+        setenv("CPUID_MASK", "avx512f,avx2,sse4.1,sse2", 1);
+        test_check(cpuid_impl_resolve(test_sum_impls, nb) == impl,
+                   "resolver: CPUID_MASK not ignored");
+        unsetenv("CPUID_MASK");
+
+        for (unsigned i = 0; i < TEST_SUM_NB; i++)
+                v[i] = i * 40503U;
+        test_check(test_sum(v, TEST_SUM_NB) == test_sum_c(v, TEST_SUM_NB),
+                   "ifunc test_sum() disagrees with %s",
+                   test_sum_impls[0].name);
+}
+
+/*
+ * feature bits as Intel SDM vol. 2A (CPUID) and AMD APM vol. 3
+ * (appendix E) document them, kept apart from CPUID_FEATURE_LIST()
+ * on purpose: the table must agree with it row for row
+ */
+enum test_reg_e {
+        TEST_EAX,
+        TEST_EBX,
+        TEST_ECX,
+        TEST_EDX,
+};
+
+struct test_ref {
+        const char *name;
+        unsigned leaf;
+        unsigned sub_leaf;
+        enum test_reg_e reg;
+        unsigned bit;
+};
+
+static const struct test_ref test_refs[] = {
+        /* SDM: 01H EDX */
+        { "fpu",                  0x00000001, 0, TEST_EDX,  0 },
+        { "vme",                  0x00000001, 0, TEST_EDX,  1 },
+        { "de",                   0x00000001, 0, TEST_EDX,  2 },
+        { "pse",                  0x00000001, 0, TEST_EDX,  3 },
+        { "tsc",                  0x00000001, 0, TEST_EDX,  4 },
+        { "msr",                  0x00000001, 0, TEST_EDX,  5 },
+        { "pae",                  0x00000001, 0, TEST_EDX,  6 },
+        { "mce",                  0x00000001, 0, TEST_EDX,  7 },
+        { "cx8",                  0x00000001, 0, TEST_EDX,  8 },
+        { "apic",                 0x00000001, 0, TEST_EDX,  9 },
+        { "sep",                  0x00000001, 0, TEST_EDX, 11 },
+        { "mtrr",                 0x00000001, 0, TEST_EDX, 12 },
+        { "pge",                  0x00000001, 0, TEST_EDX, 13 },
+        { "mca",                  0x00000001, 0, TEST_EDX, 14 },
+        { "cmov",                 0x00000001, 0, TEST_EDX, 15 },
+        { "pat",                  0x00000001, 0, TEST_EDX, 16 },
+        { "pse-36",               0x00000001, 0, TEST_EDX, 17 },
+        { "psn",                  0x00000001, 0, TEST_EDX, 18 },
+        { "clfsh",                0x00000001, 0, TEST_EDX, 19 },
+        { "ds",                   0x00000001, 0, TEST_EDX, 21 },
+        { "acpi",                 0x00000001, 0, TEST_EDX, 22 },
+        { "mmx",                  0x00000001, 0, TEST_EDX, 23 },
+        { "fxsr",                 0x00000001, 0, TEST_EDX, 24 },
+        { "sse",                  0x00000001, 0, TEST_EDX, 25 },
+        { "sse2",                 0x00000001, 0, TEST_EDX, 26 },
+        { "ss",                   0x00000001, 0, TEST_EDX, 27 },
+        { "htt",                  0x00000001, 0, TEST_EDX, 28 },
+        { "tm",                   0x00000001, 0, TEST_EDX, 29 },
+        { "ia64",                 0x00000001, 0, TEST_EDX, 30 },
+        { "pbe",                  0x00000001, 0, TEST_EDX, 31 },
+
+        /* SDM: 01H ECX */
+        { "sse3",                 0x00000001, 0, TEST_ECX,  0 },
+        { "pclmulqdq",            0x00000001, 0, TEST_ECX,  1 },
+        { "dtes64",               0x00000001, 0, TEST_ECX,  2 },
+        { "monitor",              0x00000001, 0, TEST_ECX,  3 },
+        { "ds-cpl",               0x00000001, 0, TEST_ECX,  4 },
+        { "vmx",                  0x00000001, 0, TEST_ECX,  5 },
+        { "smx",                  0x00000001, 0, TEST_ECX,  6 },
+        { "est",                  0x00000001, 0, TEST_ECX,  7 },
+        { "tm2",                  0x00000001, 0, TEST_ECX,  8 },
+        { "ssse3",                0x00000001, 0, TEST_ECX,  9 },
+        { "cnxt-id",              0x00000001, 0, TEST_ECX, 10 },
+        { "sdbg",                 0x00000001, 0, TEST_ECX, 11 },
+        { "fma",                  0x00000001, 0, TEST_ECX, 12 },
+        { "cx16",                 0x00000001, 0, TEST_ECX, 13 },
+        { "xtpr",                 0x00000001, 0, TEST_ECX, 14 },
+        { "pdcm",                 0x00000001, 0, TEST_ECX, 15 },
+        { "pcid",                 0x00000001, 0, TEST_ECX, 17 },
+        { "dca",                  0x00000001, 0, TEST_ECX, 18 },
+        { "sse4.1",               0x00000001, 0, TEST_ECX, 19 },
+        { "sse4.2",               0x00000001, 0, TEST_ECX, 20 },
+        { "x2apic",               0x00000001, 0, TEST_ECX, 21 },
+        { "movbe",                0x00000001, 0, TEST_ECX, 22 },
+        { "popcnt",               0x00000001, 0, TEST_ECX, 23 },
+        { "tsc-deadline",         0x00000001, 0, TEST_ECX, 24 },
+        { "aes",                  0x00000001, 0, TEST_ECX, 25 },
+        { "xsave",                0x00000001, 0, TEST_ECX, 26 },
+        { "osxsave",              0x00000001, 0, TEST_ECX, 27 },
+        { "avx",                  0x00000001, 0, TEST_ECX, 28 },
+        { "f16c",                 0x00000001, 0, TEST_ECX, 29 },
+        { "rdrnd",                0x00000001, 0, TEST_ECX, 30 },
+        { "hypervisor",           0x00000001, 0, TEST_ECX, 31 },
+
+        /* SDM: 07H.0 EBX */
+        { "fsgsbase",             0x00000007, 0, TEST_EBX,  0 },
+        { "tsc_adjust",           0x00000007, 0, TEST_EBX,  1 },
+        { "sgx",                  0x00000007, 0, TEST_EBX,  2 },
+        { "bmi1",                 0x00000007, 0, TEST_EBX,  3 },
+        { "hle",                  0x00000007, 0, TEST_EBX,  4 },
+        { "avx2",                 0x00000007, 0, TEST_EBX,  5 },
+        { "smep",                 0x00000007, 0, TEST_EBX,  7 },
+        { "bmi2",                 0x00000007, 0, TEST_EBX,  8 },
+        { "erms",                 0x00000007, 0, TEST_EBX,  9 },
+        { "invpcid",              0x00000007, 0, TEST_EBX, 10 },
+        { "rtm",                  0x00000007, 0, TEST_EBX, 11 },
+        { "pqm",                  0x00000007, 0, TEST_EBX, 12 },
+        { "mpx",                  0x00000007, 0, TEST_EBX, 14 },
+        { "pq",                   0x00000007, 0, TEST_EBX, 15 },
+        { "avx512f",              0x00000007, 0, TEST_EBX, 16 },
+        { "avx512dq",             0x00000007, 0, TEST_EBX, 17 },
+        { "rdseed",               0x00000007, 0, TEST_EBX, 18 },
+        { "adx",                  0x00000007, 0, TEST_EBX, 19 },
+        { "smap",                 0x00000007, 0, TEST_EBX, 20 },
+        { "avx512ifma",           0x00000007, 0, TEST_EBX, 21 },
+        { "pcommit",              0x00000007, 0, TEST_EBX, 22 },
+        { "clflushopt",           0x00000007, 0, TEST_EBX, 23 },
+        { "clwb",                 0x00000007, 0, TEST_EBX, 24 },
+        { "intel_pt",             0x00000007, 0, TEST_EBX, 25 },
+        { "avx512pf",             0x00000007, 0, TEST_EBX, 26 },
+        { "avx512er",             0x00000007, 0, TEST_EBX, 27 },
+        { "avx512cd",             0x00000007, 0, TEST_EBX, 28 },
+        { "sha",                  0x00000007, 0, TEST_EBX, 29 },
+        { "avx512bw",             0x00000007, 0, TEST_EBX, 30 },
+        { "avx512vl",             0x00000007, 0, TEST_EBX, 31 },
+
+        /* SDM: 07H.0 ECX */
+        { "prefetchwt1",          0x00000007, 0, TEST_ECX,  0 },
+        { "avx512vbmi",           0x00000007, 0, TEST_ECX,  1 },
+        { "umip",                 0x00000007, 0, TEST_ECX,  2 },
+        { "pku",                  0x00000007, 0, TEST_ECX,  3 },
+        { "ospke",                0x00000007, 0, TEST_ECX,  4 },
+        { "waitpkg",              0x00000007, 0, TEST_ECX,  5 },
+        { "avx512_vbmi2",         0x00000007, 0, TEST_ECX,  6 },
+        { "gfni",                 0x00000007, 0, TEST_ECX,  8 },
+        { "vaes",                 0x00000007, 0, TEST_ECX,  9 },
+        { "vpclmulqdq",           0x00000007, 0, TEST_ECX, 10 },
+        { "avx512_vnni",          0x00000007, 0, TEST_ECX, 11 },
+        { "avx512_bitalg",        0x00000007, 0, TEST_ECX, 12 },
+        { "avx512vpopcntdq",      0x00000007, 0, TEST_ECX, 14 },
+        { "la57",                 0x00000007, 0, TEST_ECX, 16 },
+        { "rdpid",                0x00000007, 0, TEST_ECX, 22 },
+        { "cldemote",             0x00000007, 0, TEST_ECX, 25 },
+        { "movdiri",              0x00000007, 0, TEST_ECX, 27 },
+        { "movdir64b",            0x00000007, 0, TEST_ECX, 28 },
+        { "enqcmd",               0x00000007, 0, TEST_ECX, 29 },
+        { "sgx_lc",               0x00000007, 0, TEST_ECX, 30 },
+
+        /* SDM: 07H.0 EDX */
+        { "avx512_4vnniw",        0x00000007, 0, TEST_EDX,  2 },
+        { "avx512_4fmaps",        0x00000007, 0, TEST_EDX,  3 },
+        { "fsrm",                 0x00000007, 0, TEST_EDX,  4 },
+        { "avx512_vp2intersect",  0x00000007, 0, TEST_EDX,  8 },
+        { "serialize",            0x00000007, 0, TEST_EDX, 14 },
+        { "hybrid",               0x00000007, 0, TEST_EDX, 15 },
+        { "amx_bf16",             0x00000007, 0, TEST_EDX, 22 },
+        { "avx512_fp16",          0x00000007, 0, TEST_EDX, 23 },
+        { "amx_tile",             0x00000007, 0, TEST_EDX, 24 },
+        { "amx_int8",             0x00000007, 0, TEST_EDX, 25 },
+
+        /* SDM: 07H.1 EAX */
+        { "avx_vnni",             0x00000007, 1, TEST_EAX,  4 },
+        { "avx512_bf16",          0x00000007, 1, TEST_EAX,  5 },
+        { "cmpccxadd",            0x00000007, 1, TEST_EAX,  7 },
+        { "fzrm",                 0x00000007, 1, TEST_EAX, 10 },
+        { "fsrs",                 0x00000007, 1, TEST_EAX, 11 },
+        { "fsrc",                 0x00000007, 1, TEST_EAX, 12 },
+        { "amx_fp16",             0x00000007, 1, TEST_EAX, 21 },
+        { "avx_ifma",             0x00000007, 1, TEST_EAX, 23 },
+
+        /* SDM: 07H.1 EDX */
+        { "avx_vnni_int8",        0x00000007, 1, TEST_EDX,  4 },
+        { "avx_ne_convert",       0x00000007, 1, TEST_EDX,  5 },
+        { "amx_complex",          0x00000007, 1, TEST_EDX,  8 },
+        { "avx_vnni_int16",       0x00000007, 1, TEST_EDX, 10 },
+        { "avx10",                0x00000007, 1, TEST_EDX, 19 },
+
+        /* SDM: 0DH.1 EAX */
+        { "xsaveopt",             0x0000000d, 1, TEST_EAX,  0 },
+        { "xsavec",               0x0000000d, 1, TEST_EAX,  1 },
+        { "xgetbv1",              0x0000000d, 1, TEST_EAX,  2 },
+        { "xsaves",               0x0000000d, 1, TEST_EAX,  3 },
+        { "xfd",                  0x0000000d, 1, TEST_EAX,  4 },
+
+        /* APM: Fn8000_0001 ECX */
+        { "lahf_lm",              0x80000001, 0, TEST_ECX,  0 },
+        { "cmp_legacy",           0x80000001, 0, TEST_ECX,  1 },
+        { "svm",                  0x80000001, 0, TEST_ECX,  2 },
+        { "extapic",              0x80000001, 0, TEST_ECX,  3 },
+        { "cr8_legacy",           0x80000001, 0, TEST_ECX,  4 },
+        { "lzcnt",                0x80000001, 0, TEST_ECX,  5 },
+        { "sse4a",                0x80000001, 0, TEST_ECX,  6 },
+        { "misalignsse",          0x80000001, 0, TEST_ECX,  7 },
+        { "prefetchw",            0x80000001, 0, TEST_ECX,  8 },
+        { "osvw",                 0x80000001, 0, TEST_ECX,  9 },
+        { "ibs",                  0x80000001, 0, TEST_ECX, 10 },
+        { "xop",                  0x80000001, 0, TEST_ECX, 11 },
+        { "skinit",               0x80000001, 0, TEST_ECX, 12 },
+        { "wdt",                  0x80000001, 0, TEST_ECX, 13 },
+        { "lwp",                  0x80000001, 0, TEST_ECX, 15 },
+        { "fma4",                 0x80000001, 0, TEST_ECX, 16 },
+        { "tce",                  0x80000001, 0, TEST_ECX, 17 },
+        { "nodeid_msr",           0x80000001, 0, TEST_ECX, 19 },
+        { "tbm",                  0x80000001, 0, TEST_ECX, 21 },
+        { "topoext",              0x80000001, 0, TEST_ECX, 22 },
+        { "perfctr_core",         0x80000001, 0, TEST_ECX, 23 },
+        { "perfctr_nb",           0x80000001, 0, TEST_ECX, 24 },
+        { "dbx",                  0x80000001, 0, TEST_ECX, 26 },
+        { "perftsc",              0x80000001, 0, TEST_ECX, 27 },
+        { "perfctr_llc",          0x80000001, 0, TEST_ECX, 28 },
+        { "mwaitx",               0x80000001, 0, TEST_ECX, 29 },
+
+        /* APM: Fn8000_0001 EDX */
+        { "syscall",              0x80000001, 0, TEST_EDX, 11 },
+        { "nx",                   0x80000001, 0, TEST_EDX, 20 },
+        { "mmxext",               0x80000001, 0, TEST_EDX, 22 },
+        { "fxsr_opt",             0x80000001, 0, TEST_EDX, 25 },
+        { "pdpe1gb",              0x80000001, 0, TEST_EDX, 26 },
+        { "rdtscp",               0x80000001, 0, TEST_EDX, 27 },
+        { "lm",                   0x80000001, 0, TEST_EDX, 29 },
+        { "3dnowext",             0x80000001, 0, TEST_EDX, 30 },
+        { "3dnow",                0x80000001, 0, TEST_EDX, 31 },
+
+        /* APM: Fn8000_0007 EDX */
+        { "invtsc",               0x80000007, 0, TEST_EDX,  8 },
+};
+
+/*
+ * CPUID_FEATURE_LIST() as the library compiles it
+ */
+static const struct test_ref test_rows[] = {
+#define TEST_ROW(_id, _name, _leaf, _sub_leaf, _reg, _bit, ...)        \
+        { _name, _leaf, _sub_leaf, TEST_##_reg, _bit },
+        CPUID_FEATURE_LIST(TEST_ROW)
+#undef TEST_ROW
+};
+
+static const struct test_ref *
+test_ref_find(const struct test_ref *refs,
+              unsigned nb,
+              const char *name)
+{
+        for (unsigned i = 0; i < nb; i++) {
+                if (!strcmp(refs[i].name, name))
+                        return &refs[i];
+        }
+        return NULL;
+}
+
+/*
+ * cpuid_probe_mask() keeps the preferred width and below
+ */
+static void
+test_probe_mask(void)
+{
+        static const struct {
+                enum cpuid_vec_width_e preferred;
+                const char *feature;
+                int kept;
+        } cases[] = {
+                { CPUID_VEC_128, "sse2",        1 },
+                { CPUID_VEC_128, "avx",         0 },
+                { CPUID_VEC_128, "avx2",        0 },
+                { CPUID_VEC_128, "fma",         0 },
+                { CPUID_VEC_128, "avx512f",     0 },
+                { CPUID_VEC_128, "avx512vl",    0 },
+                { CPUID_VEC_256, "avx",         1 },
+                { CPUID_VEC_256, "fma",         1 },
+                { CPUID_VEC_256, "avx512f",     0 },
+                { CPUID_VEC_256, "avx512_fp16", 0 },
+                { CPUID_VEC_256, "avx10",       0 },
+                { CPUID_VEC_512, "avx2",        1 },
+                { CPUID_VEC_512, "avx512bw",    1 },
+        };
+
+        for (unsigned i = 0; i < ARRAYOF(cases); i++) {
+                struct cpuid_simd_probe probe;
+                struct cpuid_features set;
+                int id = cpuid_feature_id(cases[i].feature);
+
+                memset(&probe, 0, sizeof(probe));
+                probe.preferred = cases[i].preferred;
+                cpuid_features_zero(&set);
+                cpuid_features_set(&set, id);
+                cpuid_probe_mask(&probe, &set);
+                test_check(cpuid_features_isset(&set, id) == cases[i].kept,
+                           "%s %s with %u bits preferred", cases[i].feature,
+                           cases[i].kept ? "dropped" : "kept",
+                           128u << cases[i].preferred);
+        }
+}
+
+/*
+ * waits are measured in TSC ticks at the rate cpuid_wait works with:
+ * a replayed dump brings another machine's TSC rate along
+ */
+#define TEST_WAIT_NS		2000000ULL	/* timeouts and delays */
+#define TEST_WAKE_NS		1000000ULL	/* waker sleeps first */
+#define TEST_WAKE_LIMIT_NS	2000000000ULL	/* a missed wake fails */
+
+struct test_waker {
+        volatile uint64_t word;
+};
+
+static uint64_t
+test_ticks(const struct cpuid_wait *w,
+           uint64_t ns)
+{
+        return (uint64_t) (((unsigned __int128) ns * w->tsc.hz) /
+                           1000000000ULL);
+}
+
+static void *
+test_wake(void *arg)
+{
+        struct test_waker *waker = arg;
+        struct timespec ts = { 0, (long) TEST_WAKE_NS };
+
+        nanosleep(&ts, NULL);
+        __atomic_store_n(&waker->word, 1, __ATOMIC_RELEASE);
+        return NULL;
+}
+
+/*
+ * every method this CPU has: no wait on a changed value, timeout
+ * not before it is due, wake on a store from another thread,
+ * delays not short
+ */
+static void
+test_wait(void)
+{
+        const struct cpuid_wait *w = cpuid_wait_read();
+        enum cpuid_wait_e detected = w->method;
+        const char *name = cpuid_wait_name(detected);
+
+        test_check(name != NULL, "wait method %u has no name",
+                   (unsigned) detected);
+        test_check(w->pause_ticks > 0, "pause not calibrated");
+        test_check(w->backoff_max && !(w->backoff_max & (w->backoff_max - 1)),
+                   "backoff %u not a power of 2", w->backoff_max);
+        test_check(detected != CPUID_WAIT_UMWAIT || w->waitpkg,
+                   "umwait without waitpkg");
+        test_check(cpuid_wait_select(CPUID_WAIT_NB) == -1,
+                   "unknown wait method selected");
+        test_check((cpuid_wait_select(CPUID_WAIT_UMWAIT) == 0) == w->waitpkg,
+                   "umwait selectable %s waitpkg",
+                   w->waitpkg ? "without" : "despite no");
+
+        for (unsigned m = 0; m < CPUID_WAIT_NB; m++) {
+                enum cpuid_wait_e method = (enum cpuid_wait_e) m;
+                struct test_waker waker = { .word = 0 };
+                uint64_t t;
+                pthread_t tid;
+                int ret;
+
+                if (cpuid_wait_select(method))
+                        continue;
+                name = cpuid_wait_name(method);
+
+                t = cpuid_rdtsc();
+                ret = cpuid_wait_until(&waker.word, 1, TEST_WAKE_LIMIT_NS);
+                t = cpuid_rdtsc() - t;
+                test_check(ret == 0 && t < test_ticks(w, TEST_WAKE_LIMIT_NS),
+                           "%s: waited on a value already changed", name);
+
+                t = cpuid_rdtsc();
+                ret = cpuid_wait_until(&waker.word, 0, TEST_WAIT_NS);
+                t = cpuid_rdtsc() - t;
+                test_check(ret == -1, "%s: no timeout, %d", name, ret);
+                test_check(t >= test_ticks(w, TEST_WAIT_NS),
+                           "%s: timed out after %llu of %llu ticks", name,
+                           (unsigned long long) t,
+                           (unsigned long long) test_ticks(w, TEST_WAIT_NS));
+
+                if (pthread_create(&tid, NULL, test_wake, &waker)) {
+                        test_check(0, "%s: no waker thread", name);
+                        continue;
+                }
+                ret = cpuid_wait_until(&waker.word, 0, TEST_WAKE_LIMIT_NS);
+                pthread_join(tid, NULL);
+                test_check(ret == 0 && waker.word == 1,
+                           "%s: store from another thread missed", name);
+
+                t = cpuid_rdtsc();
+                cpuid_wait_delay(TEST_WAIT_NS);
+                t = cpuid_rdtsc() - t;
+                test_check(t >= test_ticks(w, TEST_WAIT_NS),
+                           "%s: delay of %llu ticks, %llu asked", name,
+                           (unsigned long long) t,
+                           (unsigned long long) test_ticks(w, TEST_WAIT_NS));
+        }
+        cpuid_wait_select(detected);
+}
+
+/*
+ * cpuid_attr[] consistency, every name found back by the sorted index,
+ * every row where the manuals put it
+ */
+static void
+test_table(void)
+{
+        int bad = cpuid_table_check();
+
+        test_check(!bad, "cpuid_table_check(): %d bad entries", bad);
+        for (int id = 0; id < CPUID_FEATURE_NB; id++) {
+                const char *name = cpuid_feature_name(id);
+
+                test_check(cpuid_feature_id(name) == id,
+                           "%s not found by cpuid_feature_id()", name);
+        }
+
+        for (unsigned i = 0; i < ARRAYOF(test_rows); i++) {
+                const struct test_ref *row = &test_rows[i];
+                const struct test_ref *ref;
+
+                ref = test_ref_find(test_refs, ARRAYOF(test_refs),
+                                    row->name);
+                test_check(ref != NULL, "%s missing from the reference",
+                           row->name);
+                if (!ref)
+                        continue;
+                test_check(row->leaf == ref->leaf &&
+                           row->sub_leaf == ref->sub_leaf &&
+                           row->reg == ref->reg && row->bit == ref->bit,
+                           "%s: %#x.%u reg %u bit %u, "
+                           "manual %#x.%u reg %u bit %u", row->name,
+                           row->leaf, row->sub_leaf, row->reg, row->bit,
+                           ref->leaf, ref->sub_leaf, ref->reg, ref->bit);
+        }
+        for (unsigned i = 0; i < ARRAYOF(test_refs); i++)
+                test_check(test_ref_find(test_rows, ARRAYOF(test_rows),
+                                         test_refs[i].name) != NULL,
+                           "%s missing from CPUID_FEATURE_LIST()",
+                           test_refs[i].name);
+}
+
+/*
+ * what each recorded machine under dumps/ must decode to
+ */
+struct test_dump {
+        const char *file;
+        enum cpuid_vendor_e vendor;
+        unsigned family;
+        unsigned model;
+        const char *uarch;
+        enum cpuid_isa_level_e isa;
+        const char *impl;		/* test_sum_impls[] dispatch picks */
+        enum cpuid_tsc_src_e tsc_src;
+        uint64_t tsc_hz;		/* 0: calibrated, not checked */
+};
+
+static const struct test_dump test_dumps[] = {
+        {
+                .file    = "emeraldrapids-kvm.txt",
+                .vendor  = CPUID_VENDOR_INTEL,
+                .family  = 6,
+                .model   = 0xcf,
+                .uarch   = "emeraldrapids",
+                .isa     = CPUID_ISA_V4,
+                .impl    = "test_sum_avx512",
+                .tsc_src = CPUID_TSC_SRC_CALIBRATED,
+                .tsc_hz  = 0,
+        },
+        {
+                .file    = "epyc-milan.txt",
+                .vendor  = CPUID_VENDOR_AMD,
+                .family  = 0x19,
+                .model   = 0x01,
+                .uarch   = "zen3",
+                .isa     = CPUID_ISA_V3,
+                .impl    = "test_sum_avx2",
+                .tsc_src = CPUID_TSC_SRC_CALIBRATED,
+                .tsc_hz  = 0,
+        },
+        {
+                .file    = "icelakex-kvm.txt",
+                .vendor  = CPUID_VENDOR_INTEL,
+                .family  = 6,
+                .model   = 0x6a,
+                .uarch   = "icelake-x",
+                .isa     = CPUID_ISA_V4,
+                .impl    = "test_sum_avx512",
+                .tsc_src = CPUID_TSC_SRC_HYPERVISOR,	/* over 0x16 */
+                .tsc_hz  = 2294608000ULL,
+        },
+        {
+                .file    = "skylakex.txt",
+                .vendor  = CPUID_VENDOR_INTEL,
+                .family  = 6,
+                .model   = 0x55,
+                .uarch   = "skylake-x",
+                .isa     = CPUID_ISA_V4,
+                .impl    = "test_sum_avx512",
+                .tsc_src = CPUID_TSC_SRC_LEAF16,	/* 0x15 without crystal */
+                .tsc_hz  = 2400000000ULL,
+        },
+};
+
+static void
+test_replay(const char *path)
+{
+        const char *file = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        const struct test_dump *dump = NULL;
+        const struct cpuid_impl *impl;
+        enum cpuid_isa_level_e isa;
+        struct cpuid_uarch uarch;
+        struct cpuid_tsc tsc;
+
+        for (unsigned i = 0; i < ARRAYOF(test_dumps); i++) {
+                if (!strcmp(test_dumps[i].file, file))
+                        dump = &test_dumps[i];
+        }
+        test_check(dump != NULL, "%s: no expectations in test_dumps[]", file);
+        if (!dump)
+                return;
+
+        cpuid_uarch_read(&uarch);
+        test_check(uarch.vendor == dump->vendor, "vendor %s, %s expected",
+                   cpuid_vendor_name(uarch.vendor),
+                   cpuid_vendor_name(dump->vendor));
+        test_check(uarch.family == dump->family && uarch.model == dump->model,
+                   "family %#x model %#x, %#x %#x expected", uarch.family,
+                   uarch.model, dump->family, dump->model);
+        test_check(uarch.name && !strcmp(uarch.name, dump->uarch),
+                   "uarch %s, %s expected", uarch.name ? uarch.name : "none",
+                   dump->uarch);
+
+        isa = cpuid_isa_level(NULL);
+        test_check(isa == dump->isa, "%s, %s expected", cpuid_isa_name(isa),
+                   cpuid_isa_name(dump->isa));
+
+        impl = cpuid_impl_select(test_sum_impls, CPUID_IMPL_NB(test_sum_impls),
+                                 NULL);
+        test_check(impl && !strcmp(impl->name, dump->impl),
+                   "%s dispatched, %s expected", impl ? impl->name : "none",
+                   dump->impl);
+
+        cpuid_tsc_read(&tsc);
+        test_check(tsc.source == dump->tsc_src, "tsc source %u, %u expected",
+                   (unsigned) tsc.source, (unsigned) dump->tsc_src);
+        if (dump->tsc_hz)
+                test_check(tsc.hz == dump->tsc_hz, "tsc %llu Hz, %llu expected",
+                           (unsigned long long) tsc.hz,
+                           (unsigned long long) dump->tsc_hz);
+}
+
+/*
+ * usage: cpuid_test [dump], replays dump instead of this CPU
+ */
+int
+main(int argc,
+     char **argv)
+{
+        struct cpuid_backend dump;
+        const char *name = argc > 1 ? argv[1] : "live";
+
+        if (argc > 1 && (cpuid_dump_open(&dump, argv[1]) ||
+                         cpuid_backend_set(&dump))) {
+                fprintf(stderr, "%s: not a valid dump\n", argv[1]);
+                return 2;
+        }
+
+        if (argc > 1)
+                test_replay(argv[1]);
+        test_table();
+        test_probe_mask();
+        test_dispatch();
+        test_ifunc();
+        test_wait();
+
+        if (test_failed) {
+                fprintf(stderr, "%s: %u failed\n", name, test_failed);
+                return 1;
+        }
+        fprintf(stdout, "%s: ok\n", name);
+        return 0;
+}